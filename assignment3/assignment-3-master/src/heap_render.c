@@ -0,0 +1,264 @@
+/*
+ * heap_render.c
+ *
+ * Renders heap snapshots written by "test_heap -s" to show
+ * how fragmentation develops over a trace. Each snapshot is
+ * one row; the heap address range, scaled to the largest
+ * heap in the file, is divided into cells, each showing the
+ * fraction of its bytes that are allocated:
+ *
+ *   '#' 3/4 or more   '+' 1/2 or more   '-' 1/4 or more
+ *   '.' less than 1/4   ' ' beyond the end of the heap
+ *
+ * followed by the utilization (allocated bytes over heap size),
+ * the external fragmentation (one minus the largest free block
+ * over all free bytes), the number of free blocks, and the
+ * snapshot label. Blocks on quick lists count as neither
+ * allocated nor free.
+ *
+ * With -o the rows are also written as a PGM image, one pixel
+ * row per snapshot, with allocated storage dark and free
+ * storage light.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+
+/**
+ * usage - Explain the command line arguments
+ */
+static void usage(void) {
+    fprintf(stderr, "Usage: heap_render [-h] [-w <width>] [-o <pgm>] <snap>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-w <width>  Number of cells per row (default 64).\n");
+    fprintf(stderr, "\t-o <pgm>    Also write the rows as a PGM image to <pgm>.\n");
+    fprintf(stderr, "\t<snap>      Snapshots written by test_heap -s.\n");
+}
+
+/** Block of a snapshot */
+typedef struct {
+	size_t offset;		// byte offset from start of heap
+	size_t size;		// size in bytes
+	int state;			// 0 free, 1 allocated, 2 quick list
+} Block;
+
+/** Parsed snapshot */
+typedef struct {
+	char label[256];
+	size_t heapsize;
+	Block *blocks;
+	size_t nblocks;
+	size_t maxblocks;
+} Snapshot;
+
+/**
+ * Parse one snapshot line.
+ *
+ * @param line the line
+ * @param snap the snapshot to fill in
+ * @return true if the line was parsed
+ */
+static bool parse_snapshot(const char *line, Snapshot *snap) {
+	// label, unescaping quotes and backslashes
+	const char *cp = strstr(line, "\"label\":\"");
+	if (cp == NULL) {
+		return false;
+	}
+	cp += strlen("\"label\":\"");
+	size_t len = 0;
+	while (*cp != '\0' && *cp != '"') {
+		if (*cp == '\\' && cp[1] != '\0') {
+			cp++;
+		}
+		if (len < sizeof(snap->label) - 1) {
+			snap->label[len++] = *cp;
+		}
+		cp++;
+	}
+	snap->label[len] = '\0';
+
+	cp = strstr(cp, "\"heapsize\":");
+	if (cp == NULL) {
+		return false;
+	}
+	snap->heapsize = strtoull(cp + strlen("\"heapsize\":"), NULL, 10);
+
+	cp = strstr(cp, "\"blocks\":[");
+	if (cp == NULL) {
+		return false;
+	}
+	cp += strlen("\"blocks\":[");
+
+	// each block is [offset,size,state]
+	snap->nblocks = 0;
+	while (*cp == '[' || *cp == ',') {
+		if (*cp++ == ',') {
+			continue;
+		}
+		char *endp;
+		Block b;
+		b.offset = strtoull(cp, &endp, 10);
+		if (*endp != ',') {
+			return false;
+		}
+		b.size = strtoull(endp + 1, &endp, 10);
+		if (*endp != ',') {
+			return false;
+		}
+		b.state = (int)strtol(endp + 1, &endp, 10);
+		if (*endp != ']') {
+			return false;
+		}
+		cp = endp + 1;
+
+		if (snap->nblocks == snap->maxblocks) {
+			snap->maxblocks = (snap->maxblocks == 0) ? 1024 : 2 * snap->maxblocks;
+			snap->blocks = realloc(snap->blocks, snap->maxblocks * sizeof(Block));
+			if (snap->blocks == NULL) {
+				return false;
+			}
+		}
+		snap->blocks[snap->nblocks++] = b;
+	}
+	return *cp == ']';
+}
+
+/**
+ * Program renders heap snapshots.
+ * @param argc the argument count
+ * @param argv the argument array
+ */
+int main(int argc, char *argv[]) {
+	int c;
+	size_t width = 64;
+	char *pgmfile = NULL;
+    while ((c = getopt(argc, argv, "hw:o:")) != EOF) {
+        switch (c) {
+        case 'w': /* Cells per row */
+        	width = strtoul(optarg, NULL, 10);
+        	break;
+        case 'o': /* PGM image */
+        	pgmfile = optarg;
+        	break;
+        case 'h': /* Print this message */
+        	usage();
+            return EXIT_SUCCESS;
+        default:
+        	usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc-1 || width == 0) {
+    	usage();
+    	return EXIT_FAILURE;
+    }
+
+    FILE *snapfp = fopen(argv[optind], "r");
+    if (snapfp == NULL) {
+    	fprintf(stderr, "Cannot read snapshot file: %s\n", argv[optind]);
+    	return EXIT_FAILURE;
+    }
+
+    // first pass: scale rows to the largest heap
+    Snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    char *line = NULL;
+    size_t linecap = 0;
+    size_t nsnaps = 0;
+    size_t maxheap = 0;
+    while (getline(&line, &linecap, snapfp) > 0) {
+    	if (parse_snapshot(line, &snap)) {
+    		nsnaps++;
+    		maxheap = (snap.heapsize > maxheap) ? snap.heapsize : maxheap;
+    	}
+    }
+    if (nsnaps == 0 || maxheap == 0) {
+    	fprintf(stderr, "No snapshots in %s\n", argv[optind]);
+    	return EXIT_FAILURE;
+    }
+
+    FILE *pgmfp = NULL;
+    if (pgmfile != NULL) {
+    	pgmfp = fopen(pgmfile, "wb");
+    	if (pgmfp == NULL) {
+    		fprintf(stderr, "Cannot write image file: %s\n", pgmfile);
+    		return EXIT_FAILURE;
+    	}
+    	fprintf(pgmfp, "P5\n%zu %zu\n255\n", width, nsnaps);
+    }
+
+    double cellbytes = (double)maxheap / width;
+    double alloc[width];
+    char row[width+1];
+    unsigned char pixels[width];
+    printf("%zu bytes per cell\n", (size_t)cellbytes);
+    printf("%-*s %6s %6s %7s  %s\n", (int)width+2, "heap", "util", "frag", "nfree", "label");
+
+    // second pass: render each snapshot
+    rewind(snapfp);
+    while (getline(&line, &linecap, snapfp) > 0) {
+    	if (!parse_snapshot(line, &snap)) {
+    		continue;
+    	}
+
+    	// spread allocated bytes of each block over its cells
+    	memset(alloc, 0, sizeof(alloc));
+    	size_t nalloc = 0, nfree = 0, freebytes = 0, maxfree = 0;
+    	for (size_t i = 0; i < snap.nblocks; i++) {
+    		Block *bp = &snap.blocks[i];
+    		if (bp->state == 0) {
+    			nfree++;
+    			freebytes += bp->size;
+    			maxfree = (bp->size > maxfree) ? bp->size : maxfree;
+    			continue;
+    		}
+    		if (bp->state != 1) {
+    			continue;
+    		}
+    		nalloc += bp->size;
+    		double lo = bp->offset, hi = bp->offset + bp->size;
+    		for (size_t cell = (size_t)(lo / cellbytes); cell < width && lo < hi; cell++) {
+    			double end = (cell + 1) * cellbytes;
+    			double part = ((hi < end) ? hi : end) - lo;
+    			alloc[cell] += part;
+    			lo += part;
+    		}
+    	}
+
+    	// cells show allocated fraction of their bytes in the heap
+    	for (size_t cell = 0; cell < width; cell++) {
+    		double lo = cell * cellbytes;
+    		double inheap = (double)snap.heapsize - lo;
+    		inheap = (inheap > cellbytes) ? cellbytes : inheap;
+    		if (inheap <= 0) {
+    			row[cell] = ' ';
+    			pixels[cell] = 255;
+    			continue;
+    		}
+    		double f = alloc[cell] / inheap;
+    		row[cell] = (f >= 0.75) ? '#' : (f >= 0.5) ? '+' : (f >= 0.25) ? '-' : '.';
+    		pixels[cell] = (unsigned char)(200 - 200 * ((f > 1) ? 1 : f));
+    	}
+    	row[width] = '\0';
+
+    	double util = (snap.heapsize > 0) ? 100.0 * nalloc / snap.heapsize : 0;
+    	double frag = (freebytes > 0) ? 100.0 * (1 - (double)maxfree / freebytes) : 0;
+    	printf("|%s| %5.1f%% %5.1f%% %7zu  %s\n", row, util, frag, nfree, snap.label);
+    	if (pgmfp != NULL) {
+    		fwrite(pixels, 1, width, pgmfp);
+    	}
+    }
+
+    if (pgmfp != NULL) {
+    	fclose(pgmfp);
+    }
+    fclose(snapfp);
+    free(line);
+    free(snap.blocks);
+    return EXIT_SUCCESS;
+}
@@ -7,9 +7,12 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
-//#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #include "memlib.h"
 /*
@@ -19,6 +22,11 @@
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 #endif
 
+/*
+ * Alignment of the heap when backed by transparent huge pages
+ */
+#define HUGE_PAGE_SIZE (2*(1<<20))  /* 2 MB */
+
 /* private variables */
 /** points to first byte of heap */
 static void *mem_start_brk = NULL;
@@ -29,13 +37,82 @@ static void *mem_brk = NULL;
 /** largest legal heap address */
 static void *mem_max_addr = NULL;
 
+/** lowest address never returned by mem_sbrk; the heap is zero above it */
+static void *mem_zero_brk = NULL;
+
+/** true if heap is backed by transparent huge pages */
+static bool mem_hugepage = false;
+
+/** mapping that holds the heap */
+static void *mem_map_addr = NULL;
+static size_t mem_map_len = 0;
+
+/** Checkpoint file header, followed by metadata and heap pages */
+typedef struct {
+	char magic[8];			// MEM_CKPT_MAGIC
+	uintptr_t start;		// address of first heap byte
+	size_t heapsize;		// bytes below brk
+	size_t zerosize;		// bytes below zero brk
+	size_t datalen;			// heap bytes stored, whole pages
+	size_t metalen;			// bytes of caller metadata
+} MemCheckpoint;
+
+#define MEM_CKPT_MAGIC "memckpt1"
+
+/**
+ * mem_advise_heap - advise the kernel whether to back part of
+ *    the heap with transparent huge pages.
+ *
+ * @param addr start of the part
+ * @param len length of the part in bytes
+ */
+static void mem_advise_heap(void *addr, size_t len) {
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+	madvise(addr, len, mem_hugepage ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#endif
+}
+
+/**
+ * mem_map_heap - map the heap storage. A huge page backed heap
+ *    is aligned to the huge page size and the kernel is advised
+ *    to back it with huge pages; otherwise the kernel is advised
+ *    not to, so the two differ only in page size.
+ *
+ * @return start of the heap or NULL if it cannot be mapped
+ */
+static void *mem_map_heap(void) {
+	size_t align = mem_hugepage ? HUGE_PAGE_SIZE : mem_pagesize();
+	mem_map_len = MAX_HEAP + align;
+	mem_map_addr = mmap(NULL, mem_map_len, PROT_READ|PROT_WRITE,
+						MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (mem_map_addr == MAP_FAILED) {
+		mem_map_addr = NULL;
+		return NULL;
+	}
+
+	// round start up to page boundary
+	uintptr_t start = ((uintptr_t)mem_map_addr + align - 1) & ~(uintptr_t)(align - 1);
+	mem_advise_heap((void *)start, MAX_HEAP);
+	return (void *)start;
+}
+
+/**
+ * mem_set_hugepage - back the heap with transparent huge pages.
+ *    Takes effect at the next mem_init.
+ *
+ * @param enable true to use huge pages
+ */
+void mem_set_hugepage(bool enable) {
+	mem_hugepage = enable;
+}
+
 /**
  * mem_init - initialize the memory system model.
  */
 void mem_init(void) {
 	if (mem_start_brk == NULL) {
 		/* allocate the storage we will use to model the available VM */
-		mem_start_brk = (char *)malloc(MAX_HEAP);
+		mem_start_brk = mem_map_heap();
 		if (mem_start_brk == NULL) {
 //	  		fprintf(stderr, "mem_init_vm: malloc error\n");
 			exit(1);
@@ -43,6 +120,7 @@ void mem_init(void) {
 
 		mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
 		mem_brk = mem_start_brk;                  /* heap is empty initially */
+		mem_zero_brk = mem_start_brk;             /* fresh mapping is all zero */
 	}
 }
 
@@ -50,8 +128,11 @@ void mem_init(void) {
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void) {
-    free(mem_start_brk);
-    mem_start_brk = mem_max_addr = mem_brk = 0;
+	if (mem_map_addr != NULL) {
+		munmap(mem_map_addr, mem_map_len);
+		mem_map_addr = NULL;
+	}
+    mem_start_brk = mem_max_addr = mem_brk = mem_zero_brk = 0;
 }
 
 /**
@@ -82,9 +163,142 @@ void *mem_sbrk(int incr) {
 		return (void *)-1;
     }
     mem_brk += incr;
+    if (mem_brk > mem_zero_brk) {
+    	mem_zero_brk = mem_brk;
+    }
     return (void *)old_brk;
 }
 
+/**
+ * mem_checkpoint_offset - file offset of heap pages in a checkpoint.
+ *
+ * @param metalen bytes of caller metadata
+ * @return offset of heap pages, a multiple of the page size
+ */
+static off_t mem_checkpoint_offset(size_t metalen) {
+	size_t pagesize = mem_pagesize();
+	return (sizeof(MemCheckpoint) + metalen + pagesize - 1) / pagesize * pagesize;
+}
+
+/**
+ * mem_checkpoint - write the heap and caller metadata to a file
+ *    from which mem_restore can map it back. Only the pages below
+ *    the zero brk are stored; the heap is zero above it.
+ *
+ * @param path the checkpoint file
+ * @param meta the caller metadata
+ * @param metalen bytes of caller metadata
+ * @return true if written, false with errno set otherwise
+ */
+bool mem_checkpoint(const char *path, const void *meta, size_t metalen) {
+    if (mem_start_brk == NULL) {
+    	mem_init();
+    }
+
+	size_t pagesize = mem_pagesize();
+	MemCheckpoint ckpt;
+	memset(&ckpt, 0, sizeof(ckpt));
+	memcpy(ckpt.magic, MEM_CKPT_MAGIC, sizeof(ckpt.magic));
+	ckpt.start = (uintptr_t)mem_start_brk;
+	ckpt.heapsize = (size_t)(mem_brk - mem_start_brk);
+	ckpt.zerosize = (size_t)(mem_zero_brk - mem_start_brk);
+	ckpt.datalen = (ckpt.zerosize + pagesize - 1) / pagesize * pagesize;
+	ckpt.metalen = metalen;
+
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+
+	// header and metadata, then heap pages at a page offset
+	struct { const void *buf; size_t len; off_t off; } parts[] = {
+		{ &ckpt, sizeof(ckpt), 0 },
+		{ meta, metalen, sizeof(ckpt) },
+		{ mem_start_brk, ckpt.datalen, mem_checkpoint_offset(metalen) }
+	};
+	for (int i = 0; i < 3; i++) {
+		for (size_t done = 0; done < parts[i].len; ) {
+			ssize_t n = pwrite(fd, (const char *)parts[i].buf + done,
+							   parts[i].len - done, parts[i].off + done);
+			if (n < 0) {
+				int err = errno;
+				close(fd);
+				errno = err;
+				return false;
+			}
+			done += n;
+		}
+	}
+	return close(fd) == 0;
+}
+
+/**
+ * mem_restore - restore the heap and caller metadata written by
+ *    mem_checkpoint. The stored pages are mapped copy-on-write
+ *    from the file, so restoring costs the same for any heap
+ *    size and the file is not changed by later heap writes.
+ *    The heap must be mapped at the address it had when the
+ *    checkpoint was written, as in the same process or a
+ *    forked child. The restored pages are not backed by huge
+ *    pages. A failure before the stored pages replace the heap
+ *    leaves the heap unchanged; once they have replaced it, the
+ *    heap no longer matches mem_brk or the caller's state, so a
+ *    later failure is fatal and aborts with a message.
+ *
+ * @param path the checkpoint file
+ * @param meta receives the caller metadata
+ * @param metalen bytes of caller metadata
+ * @return true if restored, false with errno set otherwise
+ */
+bool mem_restore(const char *path, void *meta, size_t metalen) {
+    if (mem_start_brk == NULL) {
+    	mem_init();
+    }
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	// checkpoint must be of this heap with matching metadata
+	MemCheckpoint ckpt;
+	if (   pread(fd, &ckpt, sizeof(ckpt), 0) != sizeof(ckpt)
+		|| memcmp(ckpt.magic, MEM_CKPT_MAGIC, sizeof(ckpt.magic)) != 0
+		|| ckpt.start != (uintptr_t)mem_start_brk
+		|| ckpt.metalen != metalen
+		|| ckpt.heapsize > MAX_HEAP || ckpt.datalen > MAX_HEAP
+		|| pread(fd, meta, metalen, sizeof(ckpt)) != (ssize_t)metalen) {
+		close(fd);
+		errno = EINVAL;
+		return false;
+	}
+
+	// map stored pages copy-on-write and fresh zero pages above
+	if (ckpt.datalen > 0 &&
+		mmap(mem_start_brk, ckpt.datalen, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED,
+			 fd, mem_checkpoint_offset(metalen)) == MAP_FAILED) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return false;
+	}
+	close(fd);
+	if (ckpt.datalen < MAX_HEAP) {
+		void *zerop = (char *)mem_start_brk + ckpt.datalen;
+		if (mmap(zerop, MAX_HEAP - ckpt.datalen, PROT_READ|PROT_WRITE,
+				 MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0) == MAP_FAILED) {
+			fprintf(stderr, "mem_restore: cannot map heap above checkpoint: %s\n",
+					strerror(errno));
+			abort();
+		}
+		mem_advise_heap(zerop, MAX_HEAP - ckpt.datalen);
+	}
+
+	mem_brk = (char *)mem_start_brk + ckpt.heapsize;
+	mem_zero_brk = (char *)mem_start_brk + ckpt.zerosize;
+	return true;
+}
+
 /**
  * mem_heap_lo - return address of the first heap byte.
  *
@@ -104,6 +318,17 @@ void *mem_heap_hi()
     return (void *)(mem_brk - 1);
 }
 
+/**
+ * mem_heap_zero - return the lowest address never returned by
+ *    mem_sbrk since the heap was mapped. Memory at and above it
+ *    is still zero, even across mem_reset_brk.
+ *
+ * @return lowest address of never used heap memory
+ */
+void *mem_heap_zero(void) {
+    return mem_zero_brk;
+}
+
 /**
  * mem_heapsize() - returns the heap size in bytes.
  *
@@ -4,11 +4,22 @@
  *            with the system's malloc package in libc.
  */
 
+#include <stdbool.h>
+#include <stddef.h>
+
 /**
  * mem_init - initialize the memory system model.
  */
 void mem_init(void);
 
+/**
+ * mem_set_hugepage - back the heap with transparent huge pages.
+ *    Takes effect at the next mem_init.
+ *
+ * @param enable true to use huge pages
+ */
+void mem_set_hugepage(bool enable);
+
 /**
  * mem_deinit - free the storage used by the memory system model
  */
@@ -41,6 +52,15 @@ void *mem_heap_lo(void);
  */
 void *mem_heap_hi(void);
 
+/**
+ * mem_heap_zero - return the lowest address never returned by
+ *    mem_sbrk since the heap was mapped. Memory at and above it
+ *    is still zero, even across mem_reset_brk.
+ *
+ * @return lowest address of never used heap memory
+ */
+void *mem_heap_zero(void);
+
 /**
  * mem_heapsize() - returns the heap size in bytes.
  *
@@ -48,6 +68,29 @@ void *mem_heap_hi(void);
  */
 size_t mem_heapsize(void);
 
+/**
+ * mem_checkpoint - write the heap and caller metadata to a file
+ *    from which mem_restore can map it back.
+ *
+ * @param path the checkpoint file
+ * @param meta the caller metadata
+ * @param metalen bytes of caller metadata
+ * @return true if written, false with errno set otherwise
+ */
+bool mem_checkpoint(const char *path, const void *meta, size_t metalen);
+
+/**
+ * mem_restore - restore the heap and caller metadata written by
+ *    mem_checkpoint, mapping the heap copy-on-write from the file.
+ *    The heap must be at the address it had at the checkpoint.
+ *
+ * @param path the checkpoint file
+ * @param meta receives the caller metadata
+ * @param metalen bytes of caller metadata
+ * @return true if restored, false with errno set otherwise
+ */
+bool mem_restore(const char *path, void *meta, size_t metalen);
+
 /**
  * mem_pagesize() - returns the page size of the system.
  *
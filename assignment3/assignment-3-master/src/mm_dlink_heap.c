@@ -28,14 +28,19 @@
  * allow traversal of the blocks in the memory pool in either
  * direction, and simplify coalescing of adjacent free blocks.
  *
- * The two fields can be packed into bit fields of a single
+ * The fields can be packed into bit fields of a single
  * size_t word, since the size field is the number of header
- * units rather than the number of bytes in a block.
+ * units rather than the number of bytes in a block. The q
+ * flag marks an allocated block that has been freed onto a
+ * quick list (see below). The z flag marks a free block whose
+ * storage other than its headers and free list links is known
+ * to be zero, so mm_calloc() need not clear it. The g flag
+ * marks an allocated block that mm_realloc() has grown.
  *
- *     | n-1                   3  2  1  0  |  0  |
- *      -----------------------------------------
- *     | s  s  s  s  ... s  s  s  s  s  s  | a/f |
- *      -----------------------------------------
+ *     | n-1                   3  2  1  0  |  3  |  2  |  1  |  0  |
+ *      -----------------------------------------------------------
+ *     | s  s  s  s  ... s  s  s  s  s  s  |  g  |  z  |  q  | a/f |
+ *      -----------------------------------------------------------
  *
  * The free blocks are also managed as a doubly-linked list
  * circular list to make allocation and deallocation more
@@ -65,13 +70,55 @@
  *
  * This mm_free() and mm_realloc() check whether the void*
  * pointer parameter is to memory that is not part of the
- * pool or has not been allocated. It also checks whether
- * the pointer is within the block, and locates the block
- * boundry by searching the heap blocks until the one that
- * contains the pointer is found. This relies on a special
- * technique that detects a pointer that is not maximally
- * aligned. C does not provide such a capability, so an
- * approximation is used.
+ * pool or has not been allocated. The header of an allocated
+ * block also carries a canary, the block address XOR a secret
+ * chosen when the heap is reset, so a pointer is validated in
+ * constant time by checking the canary, the allocation flags,
+ * and the footer. A pointer that is not to the payload of an
+ * allocated block, including one into the interior of a block,
+ * is rejected without searching the heap.
+ *
+ * The placement policy used to choose a free block is selected
+ * at compile time by defining MM_PLACEMENT to one of:
+ *
+ *   MM_FIRST_FIT       search from the head of the free list;
+ *                      freed blocks are pushed at the head
+ *   MM_NEXT_FIT        search from a roving freep that is left
+ *                      where the previous search ended (default)
+ *   MM_BEST_FIT        search from the head and take the smallest
+ *                      of the first MM_BEST_FIT_K fitting blocks
+ *   MM_ADDR_FIRST_FIT  search from the head of a free list kept
+ *                      in address order
+ *
+ * The policy is resolved by the preprocessor, so there is no
+ * runtime dispatch cost.
+ *
+ * The policies that search from the list head keep the sizes
+ * of the first MM_FIT_CACHE free blocks in a side array, so a
+ * search that fits early scans contiguous memory instead of
+ * following links. The search prefetches the next free block
+ * while checking the current one.
+ *
+ * Freed blocks of recently freed sizes are kept on up to
+ * MM_QUICK_LISTS LIFO quick lists without being coalesced,
+ * so a free followed by a malloc of the same size does not
+ * merge and split the same block again. A quick list block
+ * stays marked allocated with its q flag set, so neighbors
+ * do not coalesce with it. The lists are flushed onto the
+ * free list when an allocation finds no fitting free block,
+ * or when they hold more than MM_QUICK_BUDGET bytes.
+ *
+ * mm_realloc() grows a block in place when the block above
+ * it is free. A block that grows again is over-provisioned
+ * geometrically, by its new size up to MM_REALLOC_SLACK bytes,
+ * so a block grown by small steps is copied O(1) times per
+ * byte. The slack is returned to the free list when the block
+ * shrinks, and with the block when it is freed.
+ *
+ * Defining MM_GUARD_SAMPLE to N > 0 sends about one in N
+ * allocations to the sampling guard-page allocator in
+ * mm_guard.c, which catches overflows and uses after free
+ * of sampled blocks when they happen.
  *
  *  @since March 4, 2019
  *  @author philip gust
@@ -79,21 +126,86 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <errno.h>
 #include <string.h>
+#include <assert.h>
+#include <time.h>
 #include "memlib.h"
 #include "mm_heap.h"
 
+/** Sample about one in MM_GUARD_SAMPLE allocations; 0 disables */
+#ifndef MM_GUARD_SAMPLE
+#define MM_GUARD_SAMPLE 0
+#endif
+
+/** Number of guarded slots for sampled allocations */
+#ifndef MM_GUARD_SLOTS
+#define MM_GUARD_SLOTS 64
+#endif
+
+#if MM_GUARD_SAMPLE > 0
+#include "mm_guard.h"
+#endif
+
+
+/** Placement policies for get_free_block() */
+#define MM_FIRST_FIT		1
+#define MM_NEXT_FIT			2
+#define MM_BEST_FIT			3
+#define MM_ADDR_FIRST_FIT	4
+
+#ifndef MM_PLACEMENT
+#define MM_PLACEMENT MM_NEXT_FIT
+#endif
+
+/** Number of fitting candidates examined by best fit */
+#ifndef MM_BEST_FIT_K
+#define MM_BEST_FIT_K 4
+#endif
+
+#if MM_PLACEMENT < MM_FIRST_FIT || MM_PLACEMENT > MM_ADDR_FIRST_FIT
+#error "MM_PLACEMENT must be one of MM_FIRST_FIT, MM_NEXT_FIT, MM_BEST_FIT, MM_ADDR_FIRST_FIT"
+#endif
+
+/** Number of first free blocks whose sizes are cached for first fit; 0 disables */
+#ifndef MM_FIT_CACHE
+#define MM_FIT_CACHE 16
+#endif
+
+/** Fit cache is used by the policies that search from the list head */
+#define MM_FIT_CACHED \
+	(MM_FIT_CACHE > 0 && (MM_PLACEMENT == MM_FIRST_FIT || MM_PLACEMENT == MM_ADDR_FIRST_FIT))
+
+/** Most bytes of slack added to a block grown again by realloc; 0 disables */
+#ifndef MM_REALLOC_SLACK
+#define MM_REALLOC_SLACK (256*1024)
+#endif
+
+/** Number of quick lists for recently freed sizes; 0 disables */
+#ifndef MM_QUICK_LISTS
+#define MM_QUICK_LISTS 8
+#endif
+
+/** Bytes in quick lists above which they are flushed */
+#ifndef MM_QUICK_BUDGET
+#define MM_QUICK_BUDGET (64*1024)
+#endif
 
 /** Header information for allocated blocks */
 typedef union Header {          /* block header/footer */
     struct {
         size_t isalloc : 1;                 // 1 if block allocated, 0 if free
-        size_t blksize: 8*sizeof(size_t)-1; // size of this block including header+footer
+        size_t isquick : 1;                 // 1 if allocated block is on a quick list
+        size_t iszero : 1;                  // 1 if free block storage is known zero
+        size_t isgrown : 1;                 // 1 if allocated block was grown by realloc
+        size_t blksize: 8*sizeof(size_t)-4; // size of this block including header+footer
                                             // measured in multiples of header size;
+        uintptr_t canary;                   // block address XOR heap_secret if allocated
     } s;
     union Header *blkp;						// pointer to adjacent block on free list
     max_align_t _align;              		// force alignment to max align boundary
@@ -106,13 +218,81 @@ static const size_t MIN_BLOCK_SIZE = 2 + MIN_PAYLOAD_SIZE;  // header + footer +
 static void do_reset(void);
 static void put_free_block(Header *bp);
 static Header *get_free_block(size_t nunits);
+static Header *find_fit(size_t nunits);
+static Header *alloc_free_block(Header *bp, size_t nunits);
 static Header *find_alloc_block(void *ap);
 static Header *extend_heap(size_t);
+static Header *get_fit_or_extend(size_t nunits);
+static void free_block(Header *bp);
+static Header *get_quick_block(size_t nunits);
+static bool grow_block(Header *bp, size_t nunits);
+static void shrink_block(Header *bp, size_t nunits);
+#if MM_QUICK_LISTS > 0
+static void flush_quick_list(size_t q);
+static void flush_quick_lists(void);
+#endif
 void visualize(const char*);
 
 /** Start of free memory list */
 static Header *freep = NULL;
 
+/** Dummy head block of the free list */
+static Header *headp = NULL;
+
+/** Secret for header canaries of allocated blocks */
+static uintptr_t heap_secret = 0;
+
+#if MM_QUICK_LISTS > 0
+/** Quick lists of freed blocks, linked through first payload unit */
+static Header *quickp[MM_QUICK_LISTS];
+
+/** Block size in units of blocks on each quick list */
+static size_t quicksize[MM_QUICK_LISTS];
+
+/** Total bytes of blocks on quick lists */
+static size_t quickbytes = 0;
+#endif
+
+#if MM_FIT_CACHED
+/** Cached size of a free block */
+typedef struct {
+	size_t blksize;		// size of block in units
+	Header *bp;			// the free block
+} FitEntry;
+
+/** Sizes of the first free blocks on the free list, in list order */
+static FitEntry fitcache[MM_FIT_CACHE];
+
+/** Number of cached blocks */
+static size_t nfitcache = 0;
+
+/**
+ * Find block in fit cache.
+ *
+ * @param bp the block
+ * @return index of block or nfitcache if not cached
+ */
+inline static size_t fitcache_find(Header *bp) {
+	size_t i = 0;
+	while (i < nfitcache && fitcache[i].bp != bp) {
+		i++;
+	}
+	return i;
+}
+
+/**
+ * Update cached size of a free block whose size changed.
+ *
+ * @param bp the block
+ */
+inline static void fitcache_resize(Header *bp) {
+	size_t i = fitcache_find(bp);
+	if (i < nfitcache) {
+		fitcache[i].blksize = bp[0].s.blksize;
+	}
+}
+#endif
+
 /**
  * Get pointer to block payload.
  *
@@ -153,6 +333,16 @@ inline static size_t mm_bytes(size_t nunits) {
     return nunits * sizeof(Header);
 }
 
+/**
+ * Canary for the header of an allocated block.
+ *
+ * @param bp the block
+ * @return the canary
+ */
+inline static uintptr_t mm_canary(Header *bp) {
+	return (uintptr_t)bp ^ heap_secret;
+}
+
 /**
  * Unlink free block from free list.
  *
@@ -163,6 +353,14 @@ inline static void unlink_free_block(Header *bp) {
 	Header *prevp = bp[1].blkp;
 	prevp[2].blkp = nextp;	 // link prev block to next block
     nextp[1].blkp = prevp;	 // link next block to prev block
+
+#if MM_FIT_CACHED
+    // remaining cached blocks are still the first on the list
+    size_t i = fitcache_find(bp);
+    if (i < nfitcache) {
+    	memmove(&fitcache[i], &fitcache[i+1], (--nfitcache - i) * sizeof(FitEntry));
+    }
+#endif
 }
 
 /**
@@ -176,6 +374,31 @@ inline static void link_free_block_after(Header *bp, Header *afterp) {
 	bp[1].blkp = afterp;
 	bp[2].blkp = nextp;
 	afterp[2].blkp = nextp[1].blkp = bp;
+
+#if MM_FIT_CACHED
+	// cache block if it is linked within or just after cached blocks
+	size_t i = (afterp == headp) ? 0 : fitcache_find(afterp) + 1;
+	if (i <= nfitcache && i < MM_FIT_CACHE) {
+		if (nfitcache == MM_FIT_CACHE) {
+			nfitcache--;
+		}
+		memmove(&fitcache[i+1], &fitcache[i], (nfitcache - i) * sizeof(FitEntry));
+		fitcache[i] = (FitEntry){ bp[0].s.blksize, bp };
+		nfitcache++;
+	}
+#endif
+}
+
+/**
+ * Block units for an allocation of nbytes, including
+ * header and footer.
+ *
+ * @param nbytes number of bytes
+ * @return number of units for the block
+ */
+inline static size_t mm_block_units(size_t nbytes) {
+    size_t nunits = mm_units(nbytes) + 2;  // +2 for header+footer
+    return (nunits < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : nunits;
 }
 
 /**
@@ -197,6 +420,9 @@ void mm_init() {
 	if (freep == NULL) {
 		mem_init();
 		do_reset();
+#if MM_GUARD_SAMPLE > 0
+		mm_guard_init(MM_GUARD_SAMPLE, MM_GUARD_SLOTS);
+#endif
 	}
 }
 
@@ -209,7 +435,84 @@ void mm_reset() {
 	} else {
 		mem_reset_brk();	// reset memlib
 		do_reset();			// rebuild heap structure
+#if MM_GUARD_SAMPLE > 0
+		mm_guard_reset();	// release sampled blocks
+#endif
+	}
+}
+
+/** Allocator state saved with a heap checkpoint */
+typedef struct {
+	Header *freep;
+	Header *headp;
+	uintptr_t heap_secret;
+#if MM_QUICK_LISTS > 0
+	Header *quickp[MM_QUICK_LISTS];
+	size_t quicksize[MM_QUICK_LISTS];
+	size_t quickbytes;
+#endif
+} HeapState;
+
+/**
+ * Write the heap and allocator state to a checkpoint file.
+ * Blocks allocated by the sampling guard allocator are not
+ * part of the heap and are not saved.
+ *
+ * @param path the checkpoint file
+ * @return true if written, false with errno set otherwise
+ */
+bool mm_checkpoint(const char *path) {
+	if (freep == NULL) {
+		mm_init();
+	}
+
+	HeapState state;
+	memset(&state, 0, sizeof(state));
+	state.freep = freep;
+	state.headp = headp;
+	state.heap_secret = heap_secret;
+#if MM_QUICK_LISTS > 0
+	memcpy(state.quickp, quickp, sizeof(quickp));
+	memcpy(state.quicksize, quicksize, sizeof(quicksize));
+	state.quickbytes = quickbytes;
+#endif
+	return mem_checkpoint(path, &state, sizeof(state));
+}
+
+/**
+ * Restore the heap and allocator state from a checkpoint
+ * file written by mm_checkpoint() in this process or its
+ * parent, in place of mm_reset(). The heap is mapped
+ * copy-on-write from the file, so it takes about the same
+ * time for any heap size.
+ *
+ * @param path the checkpoint file
+ * @return true if restored, false with errno set otherwise
+ */
+bool mm_restore(const char *path) {
+	if (freep == NULL) {
+		mm_init();
+	}
+
+	HeapState state;
+	if (!mem_restore(path, &state, sizeof(state))) {
+		return false;
 	}
+	freep = state.freep;
+	headp = state.headp;
+	heap_secret = state.heap_secret;
+#if MM_QUICK_LISTS > 0
+	memcpy(quickp, state.quickp, sizeof(quickp));
+	memcpy(quicksize, state.quicksize, sizeof(quicksize));
+	quickbytes = state.quickbytes;
+#endif
+#if MM_FIT_CACHED
+	nfitcache = 0;		// rebuilt by the next search
+#endif
+#if MM_GUARD_SAMPLE > 0
+	mm_guard_reset();	// release sampled blocks
+#endif
+	return true;
 }
 
 /**
@@ -222,8 +525,25 @@ static void do_reset() {
 		return;
 	}
 
+	// new canary secret, odd so a cleared canary never matches
+	if (getentropy(&heap_secret, sizeof(heap_secret)) != 0) {
+		heap_secret = (uintptr_t)time(NULL) * 0x9E3779B97F4A7C15u ^ (uintptr_t)&heap_secret;
+	}
+	heap_secret |= 1;
+
+#if MM_QUICK_LISTS > 0
+	// empty quick lists
+	memset(quickp, 0, sizeof(quickp));
+	memset(quicksize, 0, sizeof(quicksize));
+	quickbytes = 0;
+#endif
+
+#if MM_FIT_CACHED
+	nfitcache = 0;
+#endif
+
 	// dummy block in doubly-linked circular free list
-	freep = mem_heap_lo();
+	headp = freep = mem_heap_lo();
 	freep[0].s.blksize = freep[MIN_BLOCK_SIZE-1].s.blksize = MIN_BLOCK_SIZE;
 	freep[0].s.isalloc = freep[MIN_BLOCK_SIZE-1].s.isalloc = 1; // protect block
 	freep[1].blkp = freep[2].blkp = freep;	// circular link pre and next
@@ -238,8 +558,11 @@ static void do_reset() {
  * De-initialize memory allocator
  */
 void mm_deinit() {
+#if MM_GUARD_SAMPLE > 0
+	mm_guard_deinit();
+#endif
 	mem_deinit();
-	freep = NULL;
+	headp = freep = NULL;
 }
 
 /**
@@ -255,14 +578,27 @@ void *mm_malloc(size_t nbytes) {
     	mm_init();
     }
 
+#if MM_GUARD_SAMPLE > 0
+    // place a sampled allocation in a guarded slot
+    if (mm_guard_should_sample()) {
+    	void *ap = mm_guard_malloc(nbytes);
+    	if (ap != NULL) {
+    		return ap;
+    	}
+    }
+#endif
+
     // number of Header-sized memory units
-    size_t nunits = mm_units(nbytes) + 2;
-    if (nunits < MIN_BLOCK_SIZE) {
-    	nunits = MIN_BLOCK_SIZE;
+    size_t nunits = mm_block_units(nbytes);
+
+    // reuse recently freed block of same size
+    Header *bp = get_quick_block(nunits);
+    if (bp != NULL) {
+    	return mm_payload(bp);
     }
 
     // get free blocks of required size
-    Header *bp = get_free_block(nunits);
+    bp = get_free_block(nunits);
     if (bp == NULL) {
     	errno = ENOMEM;  // per spec
     	return NULL;
@@ -275,31 +611,280 @@ void *mm_malloc(size_t nbytes) {
  * Deallocates the memory allocation pointed to by ap.
  * If ap is NULL, no operation is performed. If ap points
  * to memory not allocated or already free, no operation
- * is performed and errno is set to EFAULT. Pointer can be
- * anywhere within previously allocated space.
+ * is performed and errno is set to EFAULT. Pointer must be
+ * the one returned by mm_malloc() or mm_realloc().
  *
  * @param ap the allocated storage to free
  */
 void mm_free(void *ap) {
 	if (ap != NULL) {
-		// find block from pointer within allocated block payload
+#if MM_GUARD_SAMPLE > 0
+		// sampled allocation is quarantined by guard allocator
+		if (mm_guard_owns(ap)) {
+			if (!mm_guard_free(ap)) {
+				errno = EFAULT;  // bad address
+			}
+			return;
+		}
+#endif
+
+		// find block from pointer to allocated block payload
 		Header *bp = find_alloc_block(ap);
 
 		if (bp == NULL) {
 			errno = EFAULT;  // bad address
 		} else {
-			// add blocks to free list
-			put_free_block(bp);
+			// add blocks to quick list or free list
+			free_block(bp);
+		}
+	}
+}
+
+/**
+ * Allocates zero-initialized memory for an array of nmemb
+ * elements of size bytes each, or returns NULL and sets
+ * errno to ENOMEM if storage cannot be allocated.
+ *
+ * Storage is cleared only if it is not known to be zero.
+ * A block carved from the tail of a known zero free block
+ * needs no clearing; a whole known zero block needs only
+ * its free list links cleared.
+ *
+ * @param nmemb the number of elements
+ * @param size the size of each element in bytes
+ * @return pointer to allocated memory or NULL if not available
+ */
+void *mm_calloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+    	errno = ENOMEM;
+    	return NULL;
+    }
+    size_t nbytes = nmemb * size;
+
+    if (freep == NULL) {
+    	mm_init();
+    }
+
+#if MM_GUARD_SAMPLE > 0
+    // sampled allocation may reuse a dirty guarded slot
+    if (mm_guard_should_sample()) {
+    	void *ap = mm_guard_malloc(nbytes);
+    	if (ap != NULL) {
+    		return memset(ap, 0, nbytes);
+    	}
+    }
+#endif
+
+    size_t nunits = mm_block_units(nbytes);
+
+    // recently freed block is dirty
+    Header *bp = get_quick_block(nunits);
+    if (bp != NULL) {
+    	return memset(mm_payload(bp), 0, mm_bytes(nunits-2));
+    }
+
+    bp = get_fit_or_extend(nunits);
+    if (bp == NULL) {
+    	errno = ENOMEM;  // per spec
+    	return NULL;
+    }
+    bool iszero = bp[0].s.iszero;
+    bool issplit = bp[0].s.blksize >= nunits+MIN_BLOCK_SIZE;
+    bp = alloc_free_block(bp, nunits);
+
+    void *ap = mm_payload(bp);
+    if (!iszero) {
+    	memset(ap, 0, mm_bytes(bp[0].s.blksize-2));
+    } else if (!issplit) {
+    	memset(ap, 0, mm_bytes(MIN_PAYLOAD_SIZE));  // free list links
+    }
+    return ap;
+}
+
+/**
+ * Returns the number of usable bytes in the allocated block
+ * pointed to by ap, excluding header and footer.
+ *
+ * @param ap the allocated block
+ * @return the usable size in bytes or 0 if ap is not allocated
+ */
+size_t mm_usable_size(void *ap) {
+	if (ap == NULL) {
+		return 0;
+	}
+
+#if MM_GUARD_SAMPLE > 0
+	if (mm_guard_owns(ap)) {
+		size_t nbytes;
+		return (mm_guard_find_alloc(ap, &nbytes) == NULL) ? 0 : nbytes;
+	}
+#endif
+
+	Header *bp = find_alloc_block(ap);
+	if (bp == NULL) {
+		return 0;
+	}
+	return mm_bytes(bp[0].s.blksize - 2);
+}
+
+/**
+ * Deallocates a block whose size is known to the caller.
+ * The block is located directly from the payload pointer,
+ * without the checks done by find_alloc_block();
+ * the size is only checked by an assertion.
+ *
+ * @param ap the allocated block returned by mm_malloc()
+ * 	or mm_realloc()
+ * @param nbytes the size requested for the block, or any
+ * 	size up to mm_usable_size(ap)
+ */
+void mm_free_sized(void *ap, size_t nbytes) {
+	if (ap == NULL) {
+		return;
+	}
+
+#if MM_GUARD_SAMPLE > 0
+	if (mm_guard_owns(ap)) {
+		mm_free(ap);
+		return;
+	}
+#endif
+
+	Header *bp = mm_block(ap);
+	assert(   bp[0].s.isalloc == 1 && bp[0].s.isquick == 0
+		   && mm_block_units(nbytes) <= bp[0].s.blksize);
+	free_block(bp);
+}
+
+/**
+ * Allocates n blocks of nbytes each, storing pointers to them
+ * in ptrs. The blocks are carved from a single split of one
+ * free block, falling back to individual allocations if no
+ * free block is large enough for all of them.
+ *
+ * @param nbytes the number of bytes in each block
+ * @param n the number of blocks
+ * @param ptrs array of n pointers to receive the blocks
+ * @return the number of blocks allocated; the remaining
+ * 	entries of ptrs are set to NULL
+ */
+size_t mm_malloc_batch(size_t nbytes, size_t n, void *ptrs[]) {
+    if (freep == NULL) {
+    	mm_init();
+    }
+    if (n == 0) {
+    	return 0;
+    }
+
+    size_t nunits = mm_block_units(nbytes);
+    if (n <= SIZE_MAX / nunits) {
+    	// get one free block for all n blocks
+    	size_t totunits = nunits * n;
+    	Header *bp = get_fit_or_extend(totunits);
+    	if (bp != NULL) {
+    		bp = alloc_free_block(bp, totunits);
+
+    		// last block gets any units left when not split
+    		size_t lastunits = bp[0].s.blksize - (n-1) * nunits;
+    		for (size_t i = 0; i < n; i++, bp += nunits) {
+    			size_t blkunits = (i == n-1) ? lastunits : nunits;
+    			bp[0].s.blksize = bp[blkunits-1].s.blksize = blkunits;
+    			bp[0].s.isalloc = bp[blkunits-1].s.isalloc = 1;
+    			bp[0].s.isquick = bp[0].s.iszero = bp[0].s.isgrown = 0;
+    			bp[0].s.canary = mm_canary(bp);
+    			ptrs[i] = mm_payload(bp);
+    		}
+    		return n;
+    	}
+    }
+
+    // not enough contiguous storage: allocate blocks one at a time
+    size_t i = 0;
+    for ( ; i < n && (ptrs[i] = mm_malloc(nbytes)) != NULL; i++) {
+    }
+    for (size_t j = i; j < n; j++) {
+    	ptrs[j] = NULL;
+    }
+    return i;
+}
+
+/**
+ * Compare block pointers by address.
+ */
+static int compare_blocks(const void *a, const void *b) {
+	uintptr_t pa = (uintptr_t)*(void* const*)a;
+	uintptr_t pb = (uintptr_t)*(void* const*)b;
+	return (pa > pb) - (pa < pb);
+}
+
+/**
+ * Deallocates n allocated blocks. The blocks are sorted by
+ * address so that runs of adjacent blocks are combined and
+ * put on the free list once, coalescing with their neighbors
+ * in a single pass. NULL entries are ignored. If an entry
+ * points to memory not allocated or already free, or repeats
+ * another entry, it is skipped and errno is set to EFAULT.
+ * Each entry of ptrs is set to NULL.
+ *
+ * @param ptrs array of n allocated blocks to free
+ * @param n the number of blocks
+ */
+void mm_free_batch(void *ptrs[], size_t n) {
+	// replace payload pointers by their blocks
+	size_t nblks = 0;
+	for (size_t i = 0; i < n; i++) {
+		void *ap = ptrs[i];
+		ptrs[i] = NULL;
+		if (ap == NULL) {
+			continue;
+		}
+#if MM_GUARD_SAMPLE > 0
+		if (mm_guard_owns(ap)) {
+			mm_free(ap);
+			continue;
+		}
+#endif
+		Header *bp = find_alloc_block(ap);
+		if (bp == NULL) {
+			errno = EFAULT;  // bad address
+		} else {
+			ptrs[nblks++] = bp;
 		}
 	}
+
+	qsort(ptrs, nblks, sizeof(void*), compare_blocks);
+
+	// combine each run of adjacent blocks and free it
+	for (size_t i = 0; i < nblks; ) {
+		Header *bp = ptrs[i];
+		size_t nunits = bp[0].s.blksize;
+		for (i++; i < nblks; i++) {
+			Header *nextp = ptrs[i];
+			if (nextp == ptrs[i-1]) {
+				errno = EFAULT;  // already freed by this batch
+			} else if (nextp == bp + nunits) {
+				nextp[0].s.canary = 0;  // header now inside run
+				nunits += nextp[0].s.blksize;
+			} else {
+				break;
+			}
+		}
+		bp[0].s.blksize = bp[nunits-1].s.blksize = nunits;
+		bp[nunits-1].s.isalloc = 1;
+		put_free_block(bp);
+	}
+
+	for (size_t i = 0; i < nblks; i++) {
+		ptrs[i] = NULL;
+	}
 }
 
 /**
  * Reallocates size bytes of memory and returns a pointer
  * to the allocated memory, or NULL if memory cannot be
  * allocated, points to memory not allocated or already
- * free. Pointer can be anywhere within previously allocated
- * space.
+ * free. Pointer must be the one returned by mm_malloc() or
+ * mm_realloc().
  *
  * @param ap the currently allocated storage
  * @param nbytes the number of bytes to allocate
@@ -310,7 +895,26 @@ void *mm_realloc(void *ap, size_t nbytes) {
 		return mm_malloc(nbytes);
 	}
 
-	// find block from pointer within allocated block payload
+#if MM_GUARD_SAMPLE > 0
+	// move sampled allocation to a new block
+	if (mm_guard_owns(ap)) {
+		size_t oldbytes;
+		void *oldap = mm_guard_find_alloc(ap, &oldbytes);
+		if (oldap == NULL) {
+			errno = EFAULT;
+			return NULL;
+		}
+		void *newap = mm_malloc(nbytes);
+		if (newap == NULL) {
+			return NULL;
+		}
+		memcpy(newap, oldap, (oldbytes < nbytes) ? oldbytes : nbytes);
+		mm_guard_free(oldap);
+		return newap;
+	}
+#endif
+
+	// find block from pointer to allocated block payload
 	Header *bp = find_alloc_block(ap);
 	if (bp == NULL) {
 		errno = EFAULT;
@@ -321,93 +925,359 @@ void *mm_realloc(void *ap, size_t nbytes) {
     size_t curunits = bp->s.blksize;
 
     // already enough units for request
-    size_t nunits = mm_units(nbytes)+2; // +2 for header+footer
+    size_t nunits = mm_block_units(nbytes);
     if (nunits <= curunits) {
+    	// slack is at most half the block and MM_REALLOC_SLACK, so a
+    	// grown block below that much less than its size has shrunk
+    	if (bp[0].s.isgrown) {
+    		size_t maxslack = mm_units(MM_REALLOC_SLACK);
+    		maxslack = (curunits/2 < maxslack) ? curunits/2 : maxslack;
+    		if (nunits < curunits - maxslack && curunits - nunits >= MIN_BLOCK_SIZE) {
+    			shrink_block(bp, nunits);  // return slack
+    			bp[0].s.isgrown = 0;
+    		}
+    	}
+    	return ap;
+    }
+
+    // over-provision a block that grows again by its new size
+    size_t provunits = nunits;
+    if (bp[0].s.isgrown) {
+    	size_t slackunits = mm_units(MM_REALLOC_SLACK);
+    	provunits += (nunits < slackunits) ? nunits : slackunits;
+    }
+
+    // grow into free block above if possible
+    if (grow_block(bp, provunits) || (provunits > nunits && grow_block(bp, nunits))) {
+    	bp[0].s.isgrown = 1;
     	return ap;
     }
 
     // allocate new block for request
-    Header *newbp = get_free_block(nunits);
+    Header *newbp = get_free_block(provunits);
+    if (newbp == NULL && provunits > nunits) {
+    	newbp = get_free_block(nunits);
+    }
     if (newbp == NULL) {
     	return NULL;
     }
+    newbp[0].s.isgrown = 1;
     void *newap = mm_payload(newbp);  // pointer to new payload
 
     // copy current payload to new payload area
     size_t apbytes = mm_bytes(curunits-2); // not header or footer
     memcpy(newap, ap, apbytes);
 
-    put_free_block(bp);  // free current storage
+    free_block(bp);  // free current storage
 
     return newap;  // pointer to new payload
 }
 
 /**
- * Get block from free block list, splitting free blocks
- * and requesting additional system space if necessary.
+ * Grow allocated block in place to nunits by joining it with
+ * the free block above it, returning any excess units to the
+ * free list.
+ *
+ * @param bp the allocated block
+ * @param nunits the number of units required
+ * @return true if the block was grown, false if the block
+ * 	above is not free or not large enough
+ */
+static bool grow_block(Header *bp, size_t nunits) {
+	size_t curunits = bp[0].s.blksize;
+	Header *nextp = bp + curunits;
+	if (nextp[0].s.isalloc == 1 || curunits + nextp[0].s.blksize < nunits) {
+		return false;
+	}
+
+	// if freep is at the joined block, move it to previous free block
+	if (freep == nextp) {
+		freep = nextp[1].blkp;
+	}
+	unlink_free_block(nextp);
+
+	// join blocks and split off any excess
+	size_t totunits = curunits + nextp[0].s.blksize;
+	bp[0].s.blksize = bp[totunits-1].s.blksize = totunits;
+	bp[totunits-1].s.isalloc = 1;
+	if (totunits - nunits >= MIN_BLOCK_SIZE) {
+		shrink_block(bp, nunits);
+	}
+	return true;
+}
+
+/**
+ * Shrink allocated block to nunits, putting the remaining
+ * units on the free list. The remainder must be at least
+ * MIN_BLOCK_SIZE units.
+ *
+ * @param bp the allocated block
+ * @param nunits the number of units to keep
+ */
+static void shrink_block(Header *bp, size_t nunits) {
+	size_t restunits = bp[0].s.blksize - nunits;
+	bp[0].s.blksize = bp[nunits-1].s.blksize = nunits;
+	bp[nunits-1].s.isalloc = 1;
+
+	Header *restp = bp + nunits;
+	restp[0].s.blksize = restp[restunits-1].s.blksize = restunits;
+	restp[0].s.isquick = 0;
+	put_free_block(restp);
+}
+
+/**
+ * Find a free block of at least nunits using the placement
+ * policy selected by MM_PLACEMENT.
+ *
+ * @param nunits the number of free units required
+ * @return pointer to a fitting free block or NULL if none
+ */
+static Header *find_fit(size_t nunits) {
+#if MM_PLACEMENT == MM_NEXT_FIT
+	Header *startp = freep;		// resume where the last search ended
+#else
+	Header *startp = headp;		// always search from the list head
+#endif
+
+#if MM_PLACEMENT == MM_BEST_FIT
+	Header *bestp = NULL;
+	size_t ncandidates = 0;
+#endif
+
+	Header *bp = startp;
+#if MM_FIT_CACHED
+	// scan cached sizes of the first free blocks in contiguous memory
+	for (size_t i = 0; i < nfitcache; i++) {
+		if (fitcache[i].blksize >= nunits) {
+			return fitcache[i].bp;
+		}
+	}
+
+	// resume list traversal after the cached blocks
+	if (nfitcache > 0) {
+		bp = fitcache[nfitcache-1].bp[2].blkp;
+		if (bp == startp) {
+			return NULL;
+		}
+	}
+#endif
+
+	/* traverse the circular list to find a block */
+	do {
+		// prefetch header and links of next block while checking this one
+		Header *nextp = bp[2].blkp;
+		__builtin_prefetch(nextp);
+		__builtin_prefetch(nextp + 2);
+
+#if MM_FIT_CACHED
+		// extend cache with the next blocks on the list
+		if (nfitcache < MM_FIT_CACHE && bp != headp) {
+			fitcache[nfitcache++] = (FitEntry){ bp[0].s.blksize, bp };
+		}
+#endif
+
+		// dummy node marked allocated
+		if ((bp[0].s.isalloc == 0) && (bp[0].s.blksize >= nunits)) {
+#if MM_PLACEMENT == MM_BEST_FIT
+			if (bestp == NULL || bp[0].s.blksize < bestp[0].s.blksize) {
+				bestp = bp;
+			}
+			// stop on a block too small to split or after K candidates
+			if (   (bp[0].s.blksize < nunits+MIN_BLOCK_SIZE)
+				|| (++ncandidates >= MM_BEST_FIT_K)) {
+				return bestp;
+			}
+#else
+			return bp;
+#endif
+		}
+
+		// advance to next free block
+		bp = nextp;
+	} while (bp != startp);
+
+#if MM_PLACEMENT == MM_BEST_FIT
+	return bestp;
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * Allocate nunits from free block, splitting the block
+ * if the remainder is large enough to be a free block.
  *
  * Blocks have header and footer blocks with size and
  * allocation flags set.
  *
- * @param nunits the number of free units required
- * @return pointer to free blocks
+ * @param bp the free block
+ * @param nunits the number of units to allocate
+ * @return pointer to the allocated block
  */
-static Header *get_free_block(size_t nunits) {
-    /* traverse the circular list to find a block */
-    Header *bp = freep;
-    while (true) {
-    	// find first fit
-    	if (   (bp[0].s.isalloc == 0) 	// dummy node marked allocated
-    		&& (bp[0].s.blksize >= nunits)) {
+static Header *alloc_free_block(Header *bp, size_t nunits) {
+    if (bp->s.blksize < nunits+MIN_BLOCK_SIZE) { // cannot split if too small
+    	// if freep is here, move it to previous free block
+    	if (freep == bp) {
+    		freep = bp[1].blkp;
+    	}
 
-            if (bp->s.blksize < nunits+MIN_BLOCK_SIZE) { // cannot split if too small
-            	// if freep is here, move it to previous free block
-            	if (freep == bp) {
-            		freep = bp[1].blkp;
-            	}
+    	// unlink allocated block from free list
+    	unlink_free_block(bp);
 
-            	// unlink allocated block from free list
-            	unlink_free_block(bp);
+        // set block size and mark allocated
+        size_t blkoff = bp[0].s.blksize;  // offset to following block
+        bp[0].s.isalloc = bp[blkoff-1].s.isalloc = 1;  // mark allocated
+    } else {		// split and allocate tail end
+    	// offset to allocated part of split block
+    	size_t blkoff = bp[0].s.blksize - nunits;
 
-                // set block size and mark allocated
-                size_t blkoff = bp[0].s.blksize;  // offset to following block
-                bp[0].s.isalloc = bp[blkoff-1].s.isalloc = 1;  // mark allocated
-            } else {		// split and allocate tail end
-            	// offset to allocated part of split block
-            	size_t blkoff = bp[0].s.blksize - nunits;
+    	// adjust size of initial free part of split block
+        bp[blkoff-1].s.blksize = bp[0].s.blksize -= nunits;
+#if MM_FIT_CACHED
+        fitcache_resize(bp);
+#endif
 
-            	// adjust size of initial free part of split block
-                bp[blkoff-1].s.blksize = bp[0].s.blksize -= nunits;
+#if MM_PLACEMENT == MM_NEXT_FIT
+        // next search resumes at the remaining free part
+        freep = bp;
+#endif
 
-                // adjust size of remaining allocated part of split block
-                bp[blkoff].s.blksize = bp[blkoff+nunits-1].s.blksize = nunits;
+        // adjust size of remaining allocated part of split block
+        bp[blkoff].s.blksize = bp[blkoff+nunits-1].s.blksize = nunits;
 
-                // mark block allocated
-                bp[blkoff].s.isalloc = bp[blkoff+nunits-1].s.isalloc = 1;
+        // mark block allocated
+        bp[blkoff].s.isalloc = bp[blkoff+nunits-1].s.isalloc = 1;
 
-                // get address of header of allocated part
-                bp+= blkoff;
-            }
+        // get address of header of allocated part
+        bp+= blkoff;
+    }
+    bp[0].s.isquick = bp[0].s.iszero = bp[0].s.isgrown = 0;
+    bp[0].s.canary = mm_canary(bp);
 
-            // return pointer to block payload
-            return bp;
-        }
+    // return pointer to allocated block
+    return bp;
+}
 
-    	// advance to next free block
-    	bp = bp[2].blkp;
+/**
+ * Get block from free block list, splitting free blocks
+ * and requesting additional system space if necessary.
+ *
+ * @param nunits the number of free units required
+ * @return pointer to free blocks
+ */
+static Header *get_free_block(size_t nunits) {
+	Header *bp = get_fit_or_extend(nunits);
+	if (bp == NULL) {
+		return NULL;                /* none left */
+	}
+	return alloc_free_block(bp, nunits);
+}
 
-    	// back where we started and nothing found
-        // so we need to get more storage
-        if (bp == freep) {                    /* wrapped around free list */
-        	bp = extend_heap(nunits);
-        	if (bp == NULL) {
-                return NULL;                /* none left */
-            }
-        	// uses new storage on next iteration
-        }
+/**
+ * Find a free block of at least nunits, flushing the quick
+ * lists and then requesting additional system space if no
+ * free block fits.
+ *
+ * @param nunits the number of free units required
+ * @return pointer to a fitting free block or NULL if none
+ */
+static Header *get_fit_or_extend(size_t nunits) {
+	Header *bp = find_fit(nunits);
+#if MM_QUICK_LISTS > 0
+	if (bp == NULL && quickbytes > 0) {
+		// coalesce deferred blocks and try again
+		flush_quick_lists();
+		bp = find_fit(nunits);
+	}
+#endif
+	if (bp == NULL) {
+		// nothing found so we need to get more storage
+		bp = extend_heap(nunits);
+	}
+	return bp;
+}
+
+/**
+ * Get a recently freed block of nunits from its quick list.
+ *
+ * @param nunits the number of units required
+ * @return pointer to the allocated block or NULL if none
+ */
+static Header *get_quick_block(size_t nunits) {
+#if MM_QUICK_LISTS > 0
+    size_t q = nunits % MM_QUICK_LISTS;
+    if (quicksize[q] == nunits && quickp[q] != NULL) {
+    	Header *bp = quickp[q];
+    	quickp[q] = bp[1].blkp;
+    	quickbytes -= mm_bytes(nunits);
+    	bp[0].s.isquick = 0;
+    	return bp;
     }
+#endif
+	return NULL;
 }
 
+/**
+ * Free an allocated block onto the quick list for its size,
+ * deferring coalescing, or onto the free block list.
+ *
+ * @param bp the block to free
+ */
+static void free_block(Header *bp) {
+	bp[0].s.isgrown = 0;
+
+#if MM_QUICK_LISTS > 0
+	size_t nunits = bp[0].s.blksize;
+	size_t q = nunits % MM_QUICK_LISTS;
+	if (quicksize[q] != nunits) {
+		// list holds another size: replace it with this one
+		flush_quick_list(q);
+		quicksize[q] = nunits;
+	}
+
+	// push on quick list; block stays marked allocated
+	bp[0].s.isquick = 1;
+	bp[1].blkp = quickp[q];
+	quickp[q] = bp;
+	quickbytes += mm_bytes(nunits);
+
+	if (quickbytes > MM_QUICK_BUDGET) {
+		flush_quick_lists();
+	}
+#else
+	put_free_block(bp);
+#endif
+}
+
+#if MM_QUICK_LISTS > 0
+/**
+ * Move the blocks on a quick list to the free block list,
+ * coalescing them with adjacent free blocks.
+ *
+ * @param q the quick list index
+ */
+static void flush_quick_list(size_t q) {
+	Header *bp = quickp[q];
+	while (bp != NULL) {
+		Header *nextp = bp[1].blkp;
+		quickbytes -= mm_bytes(bp[0].s.blksize);
+		bp[0].s.isquick = 0;
+		put_free_block(bp);
+		bp = nextp;
+	}
+	quickp[q] = NULL;
+}
+
+/**
+ * Move all blocks on quick lists to the free block list.
+ */
+static void flush_quick_lists(void) {
+	for (size_t q = 0; q < MM_QUICK_LISTS; q++) {
+		flush_quick_list(q);
+	}
+}
+#endif
+
 /**
  * Put block onto free block list, coalescing adjacent blocks
  * where possible. Sets freep to freed block after coalescing.
@@ -420,6 +1290,7 @@ static void put_free_block(Header *bp) {
 
     // mark blocks free
 	bp[0].s.isalloc = bp[nunits-1].s.isalloc = 0;
+	bp[0].s.canary = 0;
 
 	if (bp[-1].s.isalloc == 0) {  // coalesce with lower adjacent block
 		// point to lower block
@@ -428,8 +1299,22 @@ static void put_free_block(Header *bp) {
 		// set combined block size
 		nunits+= bp[0].s.blksize;  // combined units
 		bp[0].s.blksize = bp[nunits-1].s.blksize = nunits;
-	} else  { // add block to free list after freep
+#if MM_FIT_CACHED
+		fitcache_resize(bp);
+#endif
+	} else  { // add block to free list
+#if MM_PLACEMENT == MM_ADDR_FIRST_FIT
+		// after the last free block below it in address order
+		Header *afterp = headp;
+		while (afterp[2].blkp != headp && afterp[2].blkp < bp) {
+			afterp = afterp[2].blkp;
+		}
+		link_free_block_after(bp, afterp);
+#elif MM_PLACEMENT == MM_NEXT_FIT
 		link_free_block_after(bp, freep);
+#else
+		link_free_block_after(bp, headp);
+#endif
 	}
 	freep = bp;
 
@@ -441,52 +1326,50 @@ static void put_free_block(Header *bp) {
 		// set combined block size
 		nunits+= bp[nunits].s.blksize;  // combined units
 		bp[0].s.blksize = bp[nunits-1].s.blksize = nunits;
+#if MM_FIT_CACHED
+		fitcache_resize(bp);
+#endif
 	}
+
+	// freed or combined storage is not known to be zero
+	bp[0].s.iszero = 0;
 }
 
 /**
- * Find allocated block from pointer.
+ * Find allocated block from pointer in constant time.
  *
  * @param ap pointer to allocated storage
  * @return pointer to allocated block or NULL if pointer
- * 		is not within allocated block returned by mm_malloc()
+ * 		is not to the payload of a block returned by mm_malloc()
  */
 static Header *find_alloc_block(void *ap) {
-    if (ap == NULL) {	// cannot be null
-        return NULL;
+    // must be an aligned pointer within heap
+    if (ap <= mem_heap_lo() || ap >= mem_heap_hi() || !is_block_pointer(ap)) {
+    	return NULL;
     }
 
-    // pointer must be within heap
-    if (ap <= mem_heap_lo() || ap >= mem_heap_hi()) {
+    // header must carry canary for this block
+    Header *bp = mm_block(ap);
+    if (bp[0].s.canary != mm_canary(bp)) {
     	return NULL;
     }
 
-    // must be aligned
-    Header *bp;
-    if (is_block_pointer(ap)) {
-		// must be allocated
-		bp = mm_block(ap);  // point to block header
-		if (bp[0].s.isalloc == 1) {
-			// must have minimum block size
-			size_t nunits = bp[0].s.blksize;
-			if (nunits >= MIN_BLOCK_SIZE) { 	// must have min. size
-				// header and footer must match
-				if (   (bp[0].s.isalloc == bp[nunits-1].s.isalloc)
-					|| (bp[0].s.blksize == bp[nunits-1].s.blksize)) {
-					return bp;
-				}
-			}
-		}
+    // must be allocated and not freed to quick list
+    if (bp[0].s.isalloc == 0 || bp[0].s.isquick == 1) {
+    	return NULL;
     }
 
-    // find block that contains ap
-    bp = mem_heap_lo();
-    for (Header *nxtp = bp + bp[0].s.blksize;
-    	(void*)nxtp <= ap; bp = nxtp, nxtp += bp[0].s.blksize) {
+    // must have minimum size and end within heap
+    size_t nunits = bp[0].s.blksize;
+    if (nunits < MIN_BLOCK_SIZE || (void*)(bp + nunits) > mem_heap_hi()) {
+    	return NULL;
     }
 
-    // return block if was allocated
-    return (bp[0].s.isalloc == 1) ? bp : NULL;
+    // header and footer must match
+    if (bp[nunits-1].s.isalloc != 1 || bp[nunits-1].s.blksize != nunits) {
+    	return NULL;
+    }
+    return bp;
 }
 
 /**
@@ -506,6 +1389,7 @@ static Header *extend_heap(size_t nunits) {
 
     // sbrk specified number of bytes
     size_t nbytes = mm_bytes(nunits);
+    void *zerop = mem_heap_zero();
     void *cp = (void *) mem_sbrk(nbytes);
     if (cp == (void *) -1) {                 /* no space at all */
         return NULL;
@@ -515,6 +1399,7 @@ static Header *extend_heap(size_t nunits) {
     Header *bp = mm_block(cp);   // adjust for old epilogue
     bp[0].s.blksize = bp[nunits-1].s.blksize = nunits;
     bp[0].s.isalloc = bp[nunits-1].s.isalloc = 0;
+    bp[0].s.isquick = 0;
 
     // add epilogue header
 	bp[nunits].s.blksize = 1;  // add new epilogue header
@@ -523,6 +1408,11 @@ static Header *extend_heap(size_t nunits) {
 	/* add the new space to free list */
     put_free_block(bp);
 
+    // never used storage is zero unless combined with lower block
+    if (freep == bp && cp >= zerop) {
+    	bp[0].s.iszero = 1;
+    }
+
     return freep;  // set by put_free_block()
 }
 
@@ -547,13 +1437,48 @@ void visualize(const char* msg) {
     Header *tmp = freep;
     char *str = "    ";
     do {           /* traverse the list */
-		fprintf(stderr, "0x%p: %s blocks: %zu alloc: %d prev: 0x%p next: 0x%p\n", tmp, str, tmp[0].s.blksize, tmp[0].s.isalloc, tmp[1].blkp, tmp[2].blkp);
+		fprintf(stderr, "0x%p: %s blocks: %zu alloc: %d prev: 0x%p next: 0x%p\n", tmp, str, (size_t)tmp[0].s.blksize, tmp[0].s.isalloc, tmp[1].blkp, tmp[2].blkp);
 		str = " -> ";
 		tmp = tmp[2].blkp;
     }  while (tmp != freep);
     fprintf(stderr, "--- end\n\n");
 }
 
+/**
+ * Write a snapshot of every block between the prologue and
+ * the epilogue as one line of JSON:
+ *
+ *   {"label":"...","heapsize":n,"blocks":[[offset,size,state],...]}
+ *
+ * where offset is the byte offset of the block header from
+ * the start of the heap, size is the block size in bytes
+ * including header and footer, and state is 0 if the block
+ * is free, 1 if allocated, and 2 if on a quick list.
+ *
+ * @param fp the stream to write to
+ * @param label the label of the snapshot
+ */
+void mm_snapshot(FILE *fp, const char *label) {
+	fprintf(fp, "{\"label\":\"");
+	for (const char *cp = label; *cp != '\0'; cp++) {
+		if (*cp == '"' || *cp == '\\') {
+			fputc('\\', fp);
+		}
+		fputc(*cp, fp);
+	}
+	fprintf(fp, "\",\"heapsize\":%zu,\"blocks\":[", mem_heapsize());
+
+	if (headp != NULL) {
+		char *heap_lo = mem_heap_lo();
+		char *sep = "";
+		for (Header *bp = headp + headp[0].s.blksize; bp[0].s.blksize > 1; bp += bp[0].s.blksize) {
+			int state = bp[0].s.isquick ? 2 : bp[0].s.isalloc;
+			fprintf(fp, "%s[%td,%zu,%d]", sep, (char*)bp - heap_lo, mm_bytes(bp[0].s.blksize), state);
+			sep = ",";
+		}
+	}
+	fprintf(fp, "]}\n");
+}
 
 /**
  * Calculate the total amount of available free memory
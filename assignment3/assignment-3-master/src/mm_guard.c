@@ -0,0 +1,319 @@
+/*
+ * mm_guard.c
+ *
+ * Sampling guard-page allocator. The guarded pool is a separate
+ * mapping of alternating guard pages and slot pages:
+ *
+ *  --------------------------------------------------------
+ * | guard | slot 0 | guard | slot 1 | ... | slot n-1 | guard |
+ *  --------------------------------------------------------
+ *
+ * Guard pages are never accessible. A slot page is accessible
+ * only while it holds a sampled allocation, which is placed at
+ * the end of the page, rounded to max_align_t, so that running
+ * off the end touches the following guard page. The alignment
+ * slack after the allocation is filled with a byte pattern that
+ * is checked when the allocation is freed.
+ *
+ * Free slots are kept in a FIFO queue. A freed slot goes to the
+ * back and the slot at the front is reused, so a freed slot is
+ * quarantined for as long as possible before its page becomes
+ * accessible again.
+ *
+ * A SIGSEGV in the pool is reported as an overflow if it hits a
+ * guard page, or a use after free if it hits a free slot.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "memlib.h"
+#include "mm_guard.h"
+
+/** Metadata for a slot */
+typedef struct {
+	char *ap;			// allocation or NULL if free
+	size_t nbytes;		// requested size
+} Slot;
+
+/** Fill pattern for the slack between an allocation and its guard page */
+#define SLACK_FILL 0xa5
+
+/** Countdown to the next sampled allocation */
+size_t mm_guard_countdown = 0;
+
+/** Bounds of the guarded pool */
+char *mm_guard_lo = NULL, *mm_guard_hi = NULL;
+
+/** Slot metadata */
+static Slot *slots = NULL;
+
+/** Number of slots */
+static size_t nslots = 0;
+
+/** FIFO queue of free slot indexes */
+static size_t *freeq = NULL;
+static size_t freeq_head = 0, freeq_len = 0;
+
+/** Sample rate and random state for sample intervals */
+static size_t sample_rate = 0;
+static uint32_t sample_seed = 2463534242u;
+
+/** Previous SIGSEGV action */
+static struct sigaction old_segv;
+
+/**
+ * Page size of the pool.
+ */
+inline static size_t page_size(void) {
+	return mem_pagesize();
+}
+
+/**
+ * Address of slot page.
+ *
+ * @param i the slot index
+ */
+inline static char *slot_page(size_t i) {
+	return mm_guard_lo + (2*i + 1) * page_size();
+}
+
+/**
+ * Slot index of a pointer into a slot page, or nslots
+ * if it points into a guard page.
+ *
+ * @param ap pointer into the pool
+ */
+inline static size_t slot_index(const void *ap) {
+	size_t page = ((const char*)ap - mm_guard_lo) / page_size();
+	return (page % 2 == 1) ? page / 2 : nslots;
+}
+
+/**
+ * Choose the next sample interval uniformly in [1, 2*rate)
+ * so sampled allocations are not at a fixed stride.
+ */
+static void next_sample(void) {
+	sample_seed ^= sample_seed << 13;
+	sample_seed ^= sample_seed >> 17;
+	sample_seed ^= sample_seed << 5;
+	mm_guard_countdown = 1 + sample_seed % (2*sample_rate - 1);
+}
+
+/**
+ * Write a message to stderr. Uses only write(2) so it is safe
+ * to call from a signal handler.
+ */
+static void report(const char *msg, const void *addr) {
+	char buf[128];
+	size_t n = 0;
+	for (const char *s = "mm_guard: "; *s != '\0'; s++) {
+		buf[n++] = *s;
+	}
+	for (; *msg != '\0' && n < sizeof(buf) - 24; msg++) {
+		buf[n++] = *msg;
+	}
+	for (const char *s = " at 0x"; *s != '\0'; s++) {
+		buf[n++] = *s;
+	}
+	uintptr_t a = (uintptr_t)addr;
+	for (int shift = 8*sizeof(a) - 4; shift >= 0; shift -= 4) {
+		buf[n++] = "0123456789abcdef"[(a >> shift) & 0xf];
+	}
+	buf[n++] = '\n';
+	write(STDERR_FILENO, buf, n);
+}
+
+/**
+ * Report faults in the guarded pool, then defer to the
+ * previous handler.
+ */
+static void segv_handler(int sig, siginfo_t *si, void *ctx) {
+	if (mm_guard_owns(si->si_addr)) {
+		size_t i = slot_index(si->si_addr);
+		if (i == nslots) {
+			report("heap buffer overflow", si->si_addr);
+		} else if (slots[i].ap == NULL) {
+			report("heap use after free", si->si_addr);
+		}
+	}
+	sigaction(SIGSEGV, &old_segv, NULL);
+	raise(sig);
+}
+
+/**
+ * Initialize the guarded pool.
+ *
+ * @param rate sample about one in rate allocations
+ * @param n the number of guarded slots
+ */
+void mm_guard_init(size_t rate, size_t n) {
+	if (mm_guard_lo != NULL || rate == 0 || n == 0) {
+		return;
+	}
+
+	size_t poolsize = (2*n + 1) * page_size();
+	void *pool = mmap(NULL, poolsize, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	slots = calloc(n, sizeof(Slot));
+	freeq = malloc(n * sizeof(size_t));
+	if (pool == MAP_FAILED || slots == NULL || freeq == NULL) {
+		if (pool != MAP_FAILED) {
+			munmap(pool, poolsize);
+		}
+		free(slots);
+		free(freeq);
+		slots = NULL;
+		freeq = NULL;
+		return;		// run without sampling
+	}
+
+	mm_guard_lo = pool;
+	mm_guard_hi = mm_guard_lo + poolsize;
+	nslots = n;
+	sample_rate = rate;
+	mm_guard_reset();
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = segv_handler;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &old_segv);
+}
+
+/**
+ * Release all guarded slots.
+ */
+void mm_guard_reset(void) {
+	if (mm_guard_lo == NULL) {
+		return;
+	}
+	mprotect(mm_guard_lo, mm_guard_hi - mm_guard_lo, PROT_NONE);
+	for (size_t i = 0; i < nslots; i++) {
+		slots[i].ap = NULL;
+		slots[i].nbytes = 0;
+		freeq[i] = i;
+	}
+	freeq_head = 0;
+	freeq_len = nslots;
+	next_sample();
+}
+
+/**
+ * Free the guarded pool.
+ */
+void mm_guard_deinit(void) {
+	if (mm_guard_lo == NULL) {
+		return;
+	}
+	sigaction(SIGSEGV, &old_segv, NULL);
+	munmap(mm_guard_lo, mm_guard_hi - mm_guard_lo);
+	free(slots);
+	free(freeq);
+	slots = NULL;
+	freeq = NULL;
+	mm_guard_lo = mm_guard_hi = NULL;
+	nslots = freeq_len = 0;
+	mm_guard_countdown = 0;
+}
+
+/**
+ * Allocates nbytes in a guarded slot.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if nbytes
+ * 	is too large or no slot is available.
+ */
+void *mm_guard_malloc(size_t nbytes) {
+	next_sample();
+
+	size_t alignbytes = (nbytes + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+	if (mm_guard_lo == NULL || freeq_len == 0 || alignbytes > page_size() || nbytes == 0) {
+		return NULL;
+	}
+
+	// take the slot that has been free the longest
+	size_t i = freeq[freeq_head];
+	freeq_head = (freeq_head + 1) % nslots;
+	freeq_len--;
+
+	char *page = slot_page(i);
+	if (mprotect(page, page_size(), PROT_READ|PROT_WRITE) != 0) {
+		return NULL;
+	}
+	slots[i].ap = page + page_size() - alignbytes;	// end of page
+	slots[i].nbytes = nbytes;
+	memset(slots[i].ap + nbytes, SLACK_FILL, alignbytes - nbytes);
+	return slots[i].ap;
+}
+
+/**
+ * Find the slot of an allocated pointer.
+ *
+ * @param ap pointer returned by mm_guard_malloc()
+ * @return the slot index or nslots if not allocated
+ */
+static size_t find_slot(void *ap) {
+	if (!mm_guard_owns(ap)) {
+		return nslots;
+	}
+	size_t i = slot_index(ap);
+	if (i == nslots || slots[i].ap != ap) {
+		return nslots;
+	}
+	return i;
+}
+
+/**
+ * Deallocates a guarded allocation, reporting an invalid
+ * or double free, or an overflow into the alignment slack.
+ *
+ * @param ap pointer returned by mm_guard_malloc()
+ * @return true if freed, false if ap is not allocated
+ */
+bool mm_guard_free(void *ap) {
+	size_t i = find_slot(ap);
+	if (i == nslots) {
+		size_t j = mm_guard_owns(ap) ? slot_index(ap) : nslots;
+		report((j < nslots && slots[j].ap == NULL) ? "double free" : "invalid free", ap);
+		return false;
+	}
+
+	// overflow into the slack that the guard page does not cover
+	for (char *p = slots[i].ap + slots[i].nbytes; p < slot_page(i) + page_size(); p++) {
+		if ((unsigned char)*p != SLACK_FILL) {
+			report("heap buffer overflow", p);
+			break;
+		}
+	}
+
+	// quarantine: slot page is inaccessible until reused
+	mprotect(slot_page(i), page_size(), PROT_NONE);
+	slots[i].ap = NULL;
+	slots[i].nbytes = 0;
+	freeq[(freeq_head + freeq_len) % nslots] = i;
+	freeq_len++;
+	return true;
+}
+
+/**
+ * Find a guarded allocation from its pointer.
+ *
+ * @param ap pointer returned by mm_guard_malloc()
+ * @param nbytes set to the requested size of the allocation
+ * @return start of the allocation or NULL if ap is not allocated
+ */
+void *mm_guard_find_alloc(void *ap, size_t *nbytes) {
+	size_t i = find_slot(ap);
+	if (i == nslots) {
+		return NULL;
+	}
+	*nbytes = slots[i].nbytes;
+	return slots[i].ap;
+}
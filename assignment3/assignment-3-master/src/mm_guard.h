@@ -0,0 +1,88 @@
+/*
+ * mm_guard.h
+ *
+ * Sampling guard-page allocator used by the heap allocators to
+ * detect heap corruption at low cost. About one in N allocations
+ * is placed at the end of a page whose following page is kept
+ * inaccessible, so an overflow faults immediately. Freed sampled
+ * pages are made inaccessible and quarantined, so a use after
+ * free also faults.
+ */
+
+#ifndef MM_GUARD_H_
+#define MM_GUARD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Countdown to the next sampled allocation */
+extern size_t mm_guard_countdown;
+
+/** Bounds of the guarded pool */
+extern char *mm_guard_lo, *mm_guard_hi;
+
+/**
+ * Initialize the guarded pool.
+ *
+ * @param rate sample about one in rate allocations
+ * @param nslots the number of guarded slots
+ */
+void mm_guard_init(size_t rate, size_t nslots);
+
+/**
+ * Release all guarded slots.
+ */
+void mm_guard_reset(void);
+
+/**
+ * Free the guarded pool.
+ */
+void mm_guard_deinit(void);
+
+/**
+ * Allocates nbytes in a guarded slot.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if nbytes
+ * 	is too large or no slot is available.
+ */
+void *mm_guard_malloc(size_t nbytes);
+
+/**
+ * Deallocates a guarded allocation, reporting an invalid
+ * or double free, or an overflow into the alignment slack.
+ *
+ * @param ap pointer returned by mm_guard_malloc()
+ * @return true if freed, false if ap is not allocated
+ */
+bool mm_guard_free(void *ap);
+
+/**
+ * Find a guarded allocation from its pointer.
+ *
+ * @param ap pointer returned by mm_guard_malloc()
+ * @param nbytes set to the requested size of the allocation
+ * @return start of the allocation or NULL if ap is not allocated
+ */
+void *mm_guard_find_alloc(void *ap, size_t *nbytes);
+
+/**
+ * Returns true if this allocation should be sampled.
+ *
+ * @return true if this allocation should be sampled
+ */
+inline static bool mm_guard_should_sample(void) {
+	return --mm_guard_countdown == 0;
+}
+
+/**
+ * Returns true if ap points into the guarded pool.
+ *
+ * @param ap a pointer
+ * @return true if ap points into the guarded pool
+ */
+inline static bool mm_guard_owns(const void *ap) {
+	return (const char*)ap >= mm_guard_lo && (const char*)ap < mm_guard_hi;
+}
+
+#endif /* MM_GUARD_H_ */
@@ -8,6 +8,9 @@
 #ifndef MM_HEAP_H_
 #define MM_HEAP_H_
 
+#include <stdio.h>
+#include <stdbool.h>
+
 /**
  * Initialize memory allocator
  */
@@ -58,5 +61,89 @@ void mm_free(void *ap);
  */
 void *mm_realloc(void *ap, size_t size);
 
+/**
+ * Allocates zero-initialized memory for an array of nmemb
+ * elements of size bytes each, or returns NULL if request
+ * storage cannot be allocated. Provided by mm_dlink_heap.c.
+ *
+ * @param nmemb the number of elements
+ * @param size the size of each element in bytes
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_calloc(size_t nmemb, size_t size);
+
+/**
+ * Returns the number of usable bytes in the allocated block
+ * pointed to by ap, which may be more than were requested
+ * because of rounding. Provided by mm_dlink_heap.c.
+ *
+ * @param ap the allocated block
+ * @return the usable size in bytes or 0 if ap is not allocated
+ */
+size_t mm_usable_size(void *ap);
+
+/**
+ * Deallocates a block whose size is known to the caller,
+ * skipping the lookup and validation done by mm_free().
+ * Provided by mm_dlink_heap.c.
+ *
+ * @param ap the allocated block returned by mm_malloc()
+ * 	or mm_realloc(); must not be an interior pointer
+ * @param nbytes the size requested for the block, or any
+ * 	size up to mm_usable_size(ap)
+ */
+void mm_free_sized(void *ap, size_t nbytes);
+
+/**
+ * Allocates n blocks of nbytes each, storing pointers to them
+ * in ptrs. Blocks are carved from a single free block where
+ * possible. Provided by mm_dlink_heap.c.
+ *
+ * @param nbytes the number of bytes in each block
+ * @param n the number of blocks
+ * @param ptrs array of n pointers to receive the blocks
+ * @return the number of blocks allocated; the remaining
+ * 	entries of ptrs are set to NULL
+ */
+size_t mm_malloc_batch(size_t nbytes, size_t n, void *ptrs[]);
+
+/**
+ * Deallocates n allocated blocks, coalescing adjacent blocks
+ * in a single pass. NULL entries are ignored. Each entry of
+ * ptrs is set to NULL. Provided by mm_dlink_heap.c.
+ *
+ * @param ptrs array of n allocated blocks to free
+ * @param n the number of blocks
+ */
+void mm_free_batch(void *ptrs[], size_t n);
+
+/**
+ * Writes a snapshot of every block in the heap to fp as one
+ * line of JSON, for rendering by heap_render. Provided by
+ * mm_dlink_heap.c.
+ *
+ * @param fp the stream to write to
+ * @param label the label of the snapshot, e.g. trace and op
+ */
+void mm_snapshot(FILE *fp, const char *label);
+
+/**
+ * Writes the heap and allocator state to a checkpoint file.
+ * Provided by mm_dlink_heap.c.
+ *
+ * @param path the checkpoint file
+ * @return true if written, false with errno set otherwise
+ */
+bool mm_checkpoint(const char *path);
+
+/**
+ * Restores the heap and allocator state from a checkpoint file
+ * written by mm_checkpoint() in this process or its parent, in
+ * place of mm_reset(). Provided by mm_dlink_heap.c.
+ *
+ * @param path the checkpoint file
+ * @return true if restored, false with errno set otherwise
+ */
+bool mm_restore(const char *path);
 
 #endif /* MM_HEAP_H_ */
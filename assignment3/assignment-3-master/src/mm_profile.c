@@ -0,0 +1,344 @@
+/*
+ * mm_profile.c
+ *
+ * Profiling layer for the mm_heap.h allocator calls. Each
+ * call is forwarded to the allocator after recording the
+ * requested size, the growth ratio of reallocs, and the
+ * lifetime of each object measured in allocator ops.
+ *
+ * The bookkeeping tables are allocated with the C library
+ * malloc so they do not disturb the simulated heap.
+ */
+
+#define MM_PROFILE_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "mm_heap.h"
+#include "mm_profile.h"
+
+/** Growth ratio bucket width in percent */
+#define GROWTH_STEP 25
+
+/** Number of growth buckets; the last one holds larger ratios */
+#define GROWTH_BUCKETS (1000/GROWTH_STEP + 1)
+
+/** Number of power of 2 lifetime buckets */
+#define LIFETIME_BUCKETS 64
+
+/** Hash table entry; a zero key marks an empty slot */
+typedef struct {
+	uintptr_t key;	// size+1 or object address
+	size_t val;		// count or birth op
+	size_t aux;		// unused or object size
+} Slot;
+
+/** Open addressing hash table with linear probing */
+typedef struct {
+	Slot *slots;
+	size_t cap;		// power of 2
+	size_t count;
+} Table;
+
+/** requested size -> count */
+static Table sizes;
+
+/** live object address -> birth op, size */
+static Table live;
+
+/** realloc new/old ratio histogram */
+static size_t growth[GROWTH_BUCKETS];
+
+/** object lifetime histogram */
+static size_t lifetimes[LIFETIME_BUCKETS];
+
+/** number of allocator ops so far */
+static size_t nops = 0;
+
+/**
+ * Hash a key to a slot index.
+ *
+ * @param t the table
+ * @param key the key
+ * @return the home slot index for the key
+ */
+inline static size_t table_hash(Table *t, uintptr_t key) {
+	return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 17) & (t->cap - 1);
+}
+
+/**
+ * Find the slot for key, which is either the slot holding
+ * the key or the empty slot where it belongs.
+ *
+ * @param t the table
+ * @param key the key
+ * @return pointer to the slot
+ */
+static Slot *table_slot(Table *t, uintptr_t key) {
+	size_t i = table_hash(t, key);
+	while (t->slots[i].key != 0 && t->slots[i].key != key) {
+		i = (i + 1) & (t->cap - 1);
+	}
+	return &t->slots[i];
+}
+
+/**
+ * Find or add the slot for key, growing the table
+ * when it becomes half full.
+ *
+ * @param t the table
+ * @param key the key
+ * @return pointer to the slot
+ */
+static Slot *table_put(Table *t, uintptr_t key) {
+	if (2 * (t->count + 1) > t->cap) {
+		Table nt = { NULL, (t->cap == 0) ? 1024 : 2*t->cap, 0 };
+		nt.slots = calloc(nt.cap, sizeof(Slot));
+		if (nt.slots == NULL) {
+			fprintf(stderr, "mm_profile: out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < t->cap; i++) {
+			if (t->slots[i].key != 0) {
+				*table_slot(&nt, t->slots[i].key) = t->slots[i];
+				nt.count++;
+			}
+		}
+		free(t->slots);
+		*t = nt;
+	}
+
+	Slot *sp = table_slot(t, key);
+	if (sp->key == 0) {
+		sp->key = key;
+		sp->val = sp->aux = 0;
+		t->count++;
+	}
+	return sp;
+}
+
+/**
+ * Remove the slot for key if present, shifting later
+ * entries of the probe sequence back into the hole.
+ *
+ * @param t the table
+ * @param key the key
+ * @return true if the key was present
+ */
+static bool table_remove(Table *t, uintptr_t key) {
+	if (t->cap == 0) {
+		return false;
+	}
+	size_t mask = t->cap - 1;
+	size_t hole = table_slot(t, key) - t->slots;
+	if (t->slots[hole].key == 0) {
+		return false;
+	}
+	for (size_t i = (hole + 1) & mask; t->slots[i].key != 0; i = (i + 1) & mask) {
+		// move entry back if its home is not between the hole and here
+		size_t home = table_hash(t, t->slots[i].key);
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			t->slots[hole] = t->slots[i];
+			hole = i;
+		}
+	}
+	t->slots[hole].key = 0;
+	t->count--;
+	return true;
+}
+
+/**
+ * Free table storage.
+ *
+ * @param t the table
+ */
+static void table_free(Table *t) {
+	free(t->slots);
+	t->slots = NULL;
+	t->cap = t->count = 0;
+}
+
+/**
+ * Record a requested size.
+ *
+ * @param nbytes the requested size
+ */
+static void record_size(size_t nbytes) {
+	table_put(&sizes, (uintptr_t)nbytes + 1)->val++;
+}
+
+/**
+ * Record the lifetime of an object that ends now.
+ *
+ * @param birth the op at which the object was allocated
+ */
+static void record_lifetime(size_t birth) {
+	size_t age = nops - birth;
+	int bucket = 0;
+	while (bucket < LIFETIME_BUCKETS-1 && ((size_t)1 << bucket) <= age) {
+		bucket++;
+	}
+	lifetimes[bucket]++;
+}
+
+/**
+ * End the lifetimes of all live objects.
+ */
+static void end_live_objects(void) {
+	for (size_t i = 0; i < live.cap; i++) {
+		if (live.slots[i].key != 0) {
+			record_lifetime(live.slots[i].val);
+			live.slots[i].key = 0;
+		}
+	}
+	live.count = 0;
+}
+
+/**
+ * Profiling version of mm_init().
+ */
+void mm_prof_init(void) {
+	mm_init();
+}
+
+/**
+ * Profiling version of mm_reset(). Objects live at the
+ * reset are counted as surviving to the end of the trace.
+ */
+void mm_prof_reset(void) {
+	end_live_objects();
+	mm_reset();
+}
+
+/**
+ * Profiling version of mm_deinit().
+ */
+void mm_prof_deinit(void) {
+	end_live_objects();
+	table_free(&live);
+	mm_deinit();
+}
+
+/**
+ * Profiling version of mm_malloc().
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_prof_malloc(size_t nbytes) {
+	nops++;
+	record_size(nbytes);
+
+	void *ap = mm_malloc(nbytes);
+	if (ap != NULL) {
+		Slot *sp = table_put(&live, (uintptr_t)ap);
+		sp->val = nops;
+		sp->aux = nbytes;
+	}
+	return ap;
+}
+
+/**
+ * Profiling version of mm_free().
+ *
+ * @param ap the allocated storage to free
+ */
+void mm_prof_free(void *ap) {
+	nops++;
+	if (ap != NULL && live.cap != 0) {
+		Slot *sp = table_slot(&live, (uintptr_t)ap);
+		if (sp->key != 0) {
+			record_lifetime(sp->val);
+			table_remove(&live, (uintptr_t)ap);
+		}
+	}
+	mm_free(ap);
+}
+
+/**
+ * Profiling version of mm_realloc().
+ *
+ * @param ap the currently allocated storage
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_prof_realloc(void *ap, size_t nbytes) {
+	if (ap == NULL) {
+		return mm_prof_malloc(nbytes);
+	}
+
+	nops++;
+	record_size(nbytes);
+
+	// object keeps its birth op across reallocs
+	size_t birth = nops;
+	size_t oldbytes = 0;
+	if (live.cap != 0) {
+		Slot *sp = table_slot(&live, (uintptr_t)ap);
+		if (sp->key != 0) {
+			birth = sp->val;
+			oldbytes = sp->aux;
+		}
+	}
+
+	void *newap = mm_realloc(ap, nbytes);
+	if (newap == NULL) {
+		return NULL;
+	}
+
+	if (oldbytes != 0) {
+		size_t pct = nbytes * 100 / oldbytes;
+		size_t bucket = pct / GROWTH_STEP;
+		growth[(bucket < GROWTH_BUCKETS) ? bucket : GROWTH_BUCKETS-1]++;
+	}
+
+	table_remove(&live, (uintptr_t)ap);
+	Slot *sp = table_put(&live, (uintptr_t)newap);
+	sp->val = birth;
+	sp->aux = nbytes;
+	return newap;
+}
+
+/**
+ * Compare slots by key for sorting.
+ */
+static int compare_slots(const void *a, const void *b) {
+	uintptr_t ka = ((const Slot*)a)->key, kb = ((const Slot*)b)->key;
+	return (ka > kb) - (ka < kb);
+}
+
+/**
+ * Write the profile recorded so far.
+ *
+ * @param fp the output stream
+ */
+void mm_prof_dump(FILE *fp) {
+	// sizes in ascending order
+	Slot *sorted = malloc((sizes.count + 1) * sizeof(Slot));
+	size_t n = 0;
+	for (size_t i = 0; i < sizes.cap; i++) {
+		if (sizes.slots[i].key != 0) {
+			sorted[n++] = sizes.slots[i];
+		}
+	}
+	qsort(sorted, n, sizeof(Slot), compare_slots);
+	for (size_t i = 0; i < n; i++) {
+		fprintf(fp, "size %zu %zu\n", (size_t)sorted[i].key - 1, sorted[i].val);
+	}
+	free(sorted);
+
+	for (int i = 0; i < GROWTH_BUCKETS; i++) {
+		if (growth[i] != 0) {
+			fprintf(fp, "growth %d %zu\n", i * GROWTH_STEP, growth[i]);
+		}
+	}
+
+	for (int i = 0; i < LIFETIME_BUCKETS; i++) {
+		if (lifetimes[i] != 0) {
+			fprintf(fp, "lifetime %zu %zu\n", (i == 0) ? 0 : (size_t)1 << (i-1), lifetimes[i]);
+		}
+	}
+}
@@ -0,0 +1,80 @@
+/*
+ * mm_profile.h
+ *
+ * Optional profiling layer for the mm_heap.h allocator calls.
+ * Records a histogram of requested sizes, realloc growth
+ * ratios, and object lifetimes measured in allocator ops.
+ *
+ * A client compiled with MM_PROFILE defined that includes this
+ * header after mm_heap.h has its mm_heap.h calls routed through
+ * the profiling layer.
+ */
+
+#ifndef MM_PROFILE_H_
+#define MM_PROFILE_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * Profiling version of mm_init().
+ */
+void mm_prof_init(void);
+
+/**
+ * Profiling version of mm_reset(). Objects live at the
+ * reset are counted as surviving to the end of the trace.
+ */
+void mm_prof_reset(void);
+
+/**
+ * Profiling version of mm_deinit().
+ */
+void mm_prof_deinit(void);
+
+/**
+ * Profiling version of mm_malloc().
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_prof_malloc(size_t nbytes);
+
+/**
+ * Profiling version of mm_free().
+ *
+ * @param ap the allocated storage to free
+ */
+void mm_prof_free(void *ap);
+
+/**
+ * Profiling version of mm_realloc().
+ *
+ * @param ap the currently allocated storage
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_prof_realloc(void *ap, size_t nbytes);
+
+/**
+ * Write the profile recorded so far. Each line is a record
+ * type followed by a bucket and a count:
+ *
+ *   size <bytes> <count>          requested size histogram
+ *   growth <percent> <count>      realloc new/old size ratio
+ *   lifetime <ops> <count>        lifetime, power of 2 buckets
+ *
+ * @param fp the output stream
+ */
+void mm_prof_dump(FILE *fp);
+
+#if defined(MM_PROFILE) && !defined(MM_PROFILE_SOURCE)
+#define mm_init() mm_prof_init()
+#define mm_reset() mm_prof_reset()
+#define mm_deinit() mm_prof_deinit()
+#define mm_malloc(nbytes) mm_prof_malloc(nbytes)
+#define mm_free(ap) mm_prof_free(ap)
+#define mm_realloc(ap, nbytes) mm_prof_realloc(ap, nbytes)
+#endif
+
+#endif /* MM_PROFILE_H_ */
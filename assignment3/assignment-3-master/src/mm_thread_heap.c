@@ -0,0 +1,773 @@
+/*
+ * mm_thread_heap.c
+ *
+ * Thread-aware dynamic memory allocator with a heap per thread.
+ * Blocks freed by the thread that allocated them go straight
+ * back to its heap. Blocks freed by another thread are pushed
+ * onto a lock-free queue owned by the allocating heap, at the
+ * cost of one atomic exchange, and the owner drains the queue
+ * on its next allocation.
+ *
+ * The memory pool is divided into spans of SPAN_SIZE bytes
+ * aligned to SPAN_SIZE, so the span that holds a block is found
+ * by masking the block address. Each span starts with a span
+ * header.
+ *
+ *  span
+ *  --------------------------------------------------------
+ * | hdr | blk | blk | blk | ...                     | unused |
+ *  --------------------------------------------------------
+ *
+ * Small requests, up to MAX_SMALL bytes, are rounded up to one
+ * of a set of size classes. A thread heap owns spans that are
+ * each carved into blocks of a single size class. A span keeps
+ * a list of its free blocks, linked through their first word,
+ * and a bump pointer to the blocks never yet allocated. The
+ * heap keeps a doubly-linked list per size class of its spans
+ * that have free blocks. A span that becomes empty is returned
+ * to the pool unless it is the last span of its class.
+ *
+ * Large requests take a run of whole spans, with the payload
+ * following the header of the first span. Free runs are kept
+ * in a global address-ordered pool list and coalesced with
+ * adjacent runs. The pool and the underlying mem_sbrk() are
+ * protected by a global lock, which small allocations take
+ * only when they need a new span.
+ *
+ * The remote free queue is the intrusive multiple-producer
+ * single-consumer queue by Dmitry Vyukov. Producers link a
+ * block in with one atomic exchange of the queue head; the
+ * owner consumes blocks from the tail, using a stub block to
+ * avoid emptying the queue while a push is in progress.
+ *
+ * A heap is created for a thread on its first allocation. When
+ * the thread exits its heap is marked abandoned and is adopted
+ * by the next new thread, which drains frees pushed onto it
+ * in the meantime.
+ *
+ * Unlike mm_dlink_heap.c, mm_free() and mm_realloc() require
+ * the pointer returned by mm_malloc() or mm_realloc(); frees
+ * of small blocks are not checked for double frees.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "memlib.h"
+#include "mm_heap.h"
+
+/** Size and alignment of a span */
+#define SPAN_SIZE ((size_t)4*1024)
+
+/** Largest request served from a size class */
+#define MAX_SMALL (SPAN_SIZE/4)
+
+/** Maximum number of size classes */
+#define MAX_CLASSES 48
+
+/** Free block; first word links it into a free list or queue */
+typedef union Block {
+	union Block *next;					// next free block in span
+	_Atomic(union Block *) qnext;		// next block in remote free queue
+} Block;
+
+/** Multiple-producer single-consumer queue of remotely freed blocks */
+typedef struct {
+	_Atomic(Block *) head;				// last block pushed, by producers
+	Block *tail;						// next block to pop, by owner
+	Block stub;							// keeps queue non-empty
+} RemoteQueue;
+
+struct ThreadHeap;
+
+/** Span header */
+typedef struct Span {
+	struct ThreadHeap *owner;			// owning heap or NULL if large or free
+	size_t nspans;						// number of spans in run
+	size_t csize;						// block size of class or 0 if large
+	size_t cls;							// size class
+	size_t nused;						// number of allocated blocks
+	Block *free;						// free blocks
+	char *bump;							// next never allocated block
+	struct Span *prev, *next;			// on heap class list or pool list
+	bool isavail;						// on heap class list
+	bool isfree;						// on pool list
+} Span;
+
+/** Per-thread heap */
+typedef struct ThreadHeap {
+	Span *avail[MAX_CLASSES];			// spans with free blocks by class
+	RemoteQueue remote;					// blocks freed by other threads
+	struct ThreadHeap *next;			// on list of all heaps
+	bool abandoned;						// owning thread has exited
+} ThreadHeap;
+
+/** Span header size rounded to max alignment */
+#define SPAN_HDR_SIZE ((sizeof(Span) + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t))
+
+/** Block sizes of classes */
+static size_t class_size[MAX_CLASSES];
+
+/** Number of classes */
+static size_t nclasses = 0;
+
+/** Lock for the pool, mem_sbrk(), and the list of heaps */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Address-ordered list of free span runs */
+static Span *pool = NULL;
+
+/** End of spans taken from mem_sbrk(), for checks without pool_lock */
+static _Atomic(char *) pool_end = NULL;
+
+/** true once the pool is initialized; read without pool_lock */
+static _Atomic bool pool_ready = false;
+
+/** All heaps */
+static ThreadHeap *heaps = NULL;
+
+/** Generation of heaps; thread heaps from older generations are stale */
+static _Atomic unsigned heap_gen = 1;
+
+/** Heap of this thread and its generation */
+static __thread ThreadHeap *myheap = NULL;
+static __thread unsigned mygen = 0;
+
+/** Key whose destructor abandons a thread's heap */
+static pthread_key_t heap_key;
+static pthread_once_t heap_key_once = PTHREAD_ONCE_INIT;
+
+// forward declarations
+void visualize(const char*);
+
+/**
+ * Span holding an address.
+ *
+ * @param ap the address
+ * @return the span header
+ */
+inline static Span *span_of(void *ap) {
+	return (Span *)((uintptr_t)ap & ~(uintptr_t)(SPAN_SIZE-1));
+}
+
+/**
+ * Payload of a large run.
+ *
+ * @param sp the span header of the run
+ * @return the payload
+ */
+inline static void *span_payload(Span *sp) {
+	return (char *)sp + SPAN_HDR_SIZE;
+}
+
+/**
+ * Usable bytes of the block containing ap.
+ *
+ * @param sp the span holding the block
+ * @return usable size in bytes
+ */
+inline static size_t usable_bytes(Span *sp) {
+	return (sp->csize != 0) ? sp->csize : sp->nspans * SPAN_SIZE - SPAN_HDR_SIZE;
+}
+
+/**
+ * Determine whether an address is in a span taken from
+ * the pool. May be called without holding pool_lock.
+ *
+ * @param ap the address
+ * @return true if ap is in a span
+ */
+inline static bool in_pool(void *ap) {
+	return atomic_load_explicit(&pool_ready, memory_order_acquire)
+		&& ap >= mem_heap_lo()
+		&& (char *)ap < atomic_load_explicit(&pool_end, memory_order_acquire);
+}
+
+/**
+ * Initialize the size class table: multiples of 16 bytes
+ * up to 256 bytes, then four classes per power of two.
+ */
+static void init_classes(void) {
+	nclasses = 0;
+	size_t step = 16;
+	for (size_t size = 16; size <= MAX_SMALL; size += step) {
+		class_size[nclasses++] = size;
+		if (size >= 256 && (size & (size - 1)) == 0) {
+			step = size / 4;  // at each power of two from 256
+		}
+	}
+}
+
+/**
+ * Size class for a request.
+ *
+ * @param nbytes the requested size; at most MAX_SMALL
+ * @return the size class
+ */
+inline static size_t size_class(size_t nbytes) {
+	if (nbytes <= 256) {
+		return (nbytes <= 16) ? 0 : (nbytes + 15) / 16 - 1;
+	}
+	size_t cls = 16;  // first class above 256 bytes
+	while (class_size[cls] < nbytes) {
+		cls++;
+	}
+	return cls;
+}
+
+/**
+ * Initialize the pool, aligning the break to a span
+ * boundary. Called with pool_lock held.
+ */
+static void pool_init(void) {
+	pool = NULL;
+	char *brk = mem_sbrk(0);
+	size_t pad = (SPAN_SIZE - (uintptr_t)brk % SPAN_SIZE) % SPAN_SIZE;
+	if (pad != 0) {
+		mem_sbrk(pad);
+	}
+	atomic_store_explicit(&pool_end, brk + pad, memory_order_release);
+	atomic_store_explicit(&pool_ready, true, memory_order_release);
+}
+
+/**
+ * Get a run of nspans spans from the pool, splitting a free
+ * run or extending the heap. Called with pool_lock held.
+ *
+ * @param nspans the number of spans
+ * @return the run or NULL if not available
+ */
+static Span *pool_get(size_t nspans) {
+	if (!pool_ready) {
+		pool_init();
+	}
+
+	// first fit in address order
+	Span *lastp = NULL;
+	for (Span **pp = &pool, *sp = pool; sp != NULL; pp = &sp->next, sp = sp->next) {
+		if (sp->nspans >= nspans) {
+			if (sp->nspans > nspans) {		// split off the rest
+				Span *restp = (Span *)((char *)sp + nspans * SPAN_SIZE);
+				restp->nspans = sp->nspans - nspans;
+				restp->next = sp->next;
+				restp->isfree = true;
+				*pp = restp;
+			} else {
+				*pp = sp->next;
+			}
+			sp->nspans = nspans;
+			sp->isfree = false;
+			return sp;
+		}
+		lastp = sp;
+	}
+
+	// extend the last free run if it ends at the break
+	size_t have = 0;
+	char *endp = atomic_load_explicit(&pool_end, memory_order_relaxed);
+	if (lastp != NULL && (char *)lastp + lastp->nspans * SPAN_SIZE == endp) {
+		have = lastp->nspans;
+	}
+	if ((nspans - have) > (size_t)INT32_MAX / SPAN_SIZE) {
+		return NULL;
+	}
+	char *cp = mem_sbrk((int)((nspans - have) * SPAN_SIZE));
+	if (cp == (char *)-1) {
+		return NULL;
+	}
+
+	atomic_store_explicit(&pool_end, cp + (nspans - have) * SPAN_SIZE, memory_order_release);
+
+	Span *sp = (Span *)cp;
+	if (have != 0) {		// unlink last free run and use it
+		Span **pp = &pool;
+		while (*pp != lastp) {
+			pp = &(*pp)->next;
+		}
+		*pp = NULL;
+		sp = lastp;
+	}
+	sp->nspans = nspans;
+	sp->isfree = false;
+	return sp;
+}
+
+/**
+ * Put a run back in the pool, coalescing it with adjacent
+ * free runs. Called with pool_lock held.
+ *
+ * @param sp the run
+ */
+static void pool_put(Span *sp) {
+	sp->owner = NULL;
+	sp->csize = 0;
+	sp->isfree = true;
+
+	// find free runs before and after in address order
+	Span *prevp = NULL, *nextp = pool;
+	while (nextp != NULL && nextp < sp) {
+		prevp = nextp;
+		nextp = nextp->next;
+	}
+
+	if (nextp != NULL && (char *)sp + sp->nspans * SPAN_SIZE == (char *)nextp) {
+		sp->nspans += nextp->nspans;		// join upper run
+		nextp = nextp->next;
+	}
+	sp->next = nextp;
+
+	if (prevp != NULL && (char *)prevp + prevp->nspans * SPAN_SIZE == (char *)sp) {
+		prevp->nspans += sp->nspans;		// join lower run
+		prevp->next = nextp;
+	} else if (prevp != NULL) {
+		prevp->next = sp;
+	} else {
+		pool = sp;
+	}
+}
+
+/**
+ * Initialize a remote free queue to empty.
+ *
+ * @param q the queue
+ */
+static void remote_init(RemoteQueue *q) {
+	atomic_store_explicit(&q->stub.qnext, NULL, memory_order_relaxed);
+	atomic_store_explicit(&q->head, &q->stub, memory_order_relaxed);
+	q->tail = &q->stub;
+}
+
+/**
+ * Push a block onto a remote free queue; may be called by
+ * any thread.
+ *
+ * @param q the queue
+ * @param bp the block
+ */
+inline static void remote_push(RemoteQueue *q, Block *bp) {
+	atomic_store_explicit(&bp->qnext, NULL, memory_order_relaxed);
+	Block *prevp = atomic_exchange_explicit(&q->head, bp, memory_order_acq_rel);
+	atomic_store_explicit(&prevp->qnext, bp, memory_order_release);
+}
+
+/**
+ * Pop a block from a remote free queue; called only by the
+ * owner of the queue.
+ *
+ * @param q the queue
+ * @return the block or NULL if the queue is empty or a push
+ * 	is still in progress
+ */
+static Block *remote_pop(RemoteQueue *q) {
+	Block *tailp = q->tail;
+	Block *nextp = atomic_load_explicit(&tailp->qnext, memory_order_acquire);
+	if (tailp == &q->stub) {		// skip the stub
+		if (nextp == NULL) {
+			return NULL;
+		}
+		q->tail = tailp = nextp;
+		nextp = atomic_load_explicit(&tailp->qnext, memory_order_acquire);
+	}
+	if (nextp != NULL) {
+		q->tail = nextp;
+		return tailp;
+	}
+	if (tailp != atomic_load_explicit(&q->head, memory_order_acquire)) {
+		return NULL;				// push in progress
+	}
+
+	// tail is the last block: push stub behind it to pop it
+	remote_push(q, &q->stub);
+	nextp = atomic_load_explicit(&tailp->qnext, memory_order_acquire);
+	if (nextp != NULL) {
+		q->tail = nextp;
+		return tailp;
+	}
+	return NULL;
+}
+
+/**
+ * Add span to the heap list of spans with free blocks.
+ *
+ * @param hp the heap
+ * @param sp the span
+ */
+static void avail_push(ThreadHeap *hp, Span *sp) {
+	sp->prev = NULL;
+	sp->next = hp->avail[sp->cls];
+	if (sp->next != NULL) {
+		sp->next->prev = sp;
+	}
+	hp->avail[sp->cls] = sp;
+	sp->isavail = true;
+}
+
+/**
+ * Remove span from the heap list of spans with free blocks.
+ *
+ * @param hp the heap
+ * @param sp the span
+ */
+static void avail_remove(ThreadHeap *hp, Span *sp) {
+	if (sp->prev != NULL) {
+		sp->prev->next = sp->next;
+	} else {
+		hp->avail[sp->cls] = sp->next;
+	}
+	if (sp->next != NULL) {
+		sp->next->prev = sp->prev;
+	}
+	sp->isavail = false;
+}
+
+/**
+ * Free a block of a span owned by this thread's heap.
+ *
+ * @param hp the heap
+ * @param sp the span of the block
+ * @param bp the block
+ */
+static void free_local(ThreadHeap *hp, Span *sp, Block *bp) {
+	bp->next = sp->free;
+	sp->free = bp;
+	sp->nused--;
+
+	if (!sp->isavail) {			// was full
+		avail_push(hp, sp);
+	} else if (sp->nused == 0 && (sp->prev != NULL || sp->next != NULL)) {
+		// return empty span unless it is the last of its class
+		avail_remove(hp, sp);
+		pthread_mutex_lock(&pool_lock);
+		pool_put(sp);
+		pthread_mutex_unlock(&pool_lock);
+	}
+}
+
+/**
+ * Free blocks other threads pushed onto the heap's queue.
+ *
+ * @param hp the heap
+ */
+inline static void drain_remote(ThreadHeap *hp) {
+	Block *bp;
+	while ((bp = remote_pop(&hp->remote)) != NULL) {
+		free_local(hp, span_of(bp), bp);
+	}
+}
+
+/**
+ * Reset heap to own no spans.
+ *
+ * @param hp the heap
+ */
+static void heap_reset(ThreadHeap *hp) {
+	memset(hp->avail, 0, sizeof(hp->avail));
+	remote_init(&hp->remote);
+}
+
+/**
+ * Abandon the heap of an exiting thread.
+ *
+ * @param arg the heap
+ */
+static void heap_abandon(void *arg) {
+	ThreadHeap *hp = arg;
+	pthread_mutex_lock(&pool_lock);
+	if (mygen == atomic_load(&heap_gen)) {
+		hp->abandoned = true;
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Create the key that abandons heaps of exiting threads.
+ */
+static void heap_key_init(void) {
+	pthread_key_create(&heap_key, heap_abandon);
+}
+
+/**
+ * Get the heap of this thread if it has one.
+ *
+ * @return the heap or NULL if this thread has not allocated
+ */
+inline static ThreadHeap *current_heap(void) {
+	unsigned gen = atomic_load_explicit(&heap_gen, memory_order_acquire);
+	return (myheap != NULL && mygen == gen) ? myheap : NULL;
+}
+
+/**
+ * Get the heap of this thread, adopting an abandoned heap
+ * or creating one if needed.
+ *
+ * @return the heap or NULL if not available
+ */
+static ThreadHeap *get_heap(void) {
+	ThreadHeap *hp = current_heap();
+	if (hp != NULL) {
+		return hp;
+	}
+	unsigned gen = atomic_load_explicit(&heap_gen, memory_order_acquire);
+
+	pthread_once(&heap_key_once, heap_key_init);
+	pthread_mutex_lock(&pool_lock);
+	hp = heaps;
+	while (hp != NULL && !hp->abandoned) {
+		hp = hp->next;
+	}
+	if (hp != NULL) {
+		hp->abandoned = false;		// adopt
+	} else {
+		hp = calloc(1, sizeof(ThreadHeap));
+		if (hp != NULL) {
+			heap_reset(hp);
+			hp->next = heaps;
+			heaps = hp;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if (hp != NULL) {
+		myheap = hp;
+		mygen = gen;
+		pthread_setspecific(heap_key, hp);
+	}
+	return hp;
+}
+
+/**
+ * Initialize memory allocator
+ */
+void mm_init() {
+	pthread_mutex_lock(&pool_lock);
+	if (!pool_ready) {
+		mem_init();
+		init_classes();
+		pool_init();
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Reset memory allocator. No other thread may be using
+ * the allocator.
+ */
+void mm_reset() {
+	pthread_mutex_lock(&pool_lock);
+	if (pool_ready) {
+		mem_reset_brk();
+	} else {
+		mem_init();
+		init_classes();
+	}
+	pool_init();
+	for (ThreadHeap *hp = heaps; hp != NULL; hp = hp->next) {
+		heap_reset(hp);
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * De-initialize memory allocator. No other thread may be
+ * using the allocator.
+ */
+void mm_deinit() {
+	pthread_mutex_lock(&pool_lock);
+	while (heaps != NULL) {
+		ThreadHeap *hp = heaps;
+		heaps = hp->next;
+		free(hp);
+	}
+	atomic_fetch_add(&heap_gen, 1);	// invalidate thread heaps
+	myheap = NULL;
+	pool = NULL;
+	atomic_store_explicit(&pool_ready, false, memory_order_release);
+	mem_deinit();
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Allocates size bytes of memory and returns a pointer to
+ * allocated memory, or returns NULL and sets errno to ENOMEM
+ * if storage cannot be allocated.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available
+ */
+void *mm_malloc(size_t nbytes) {
+	if (!atomic_load_explicit(&pool_ready, memory_order_acquire)) {
+		mm_init();
+	}
+
+	ThreadHeap *hp = get_heap();
+	if (hp == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	drain_remote(hp);
+
+	if (nbytes > MAX_SMALL) {
+		// run of spans with payload after first header
+		if (nbytes > SIZE_MAX - SPAN_HDR_SIZE - SPAN_SIZE) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		size_t nspans = (nbytes + SPAN_HDR_SIZE + SPAN_SIZE - 1) / SPAN_SIZE;
+		pthread_mutex_lock(&pool_lock);
+		Span *sp = pool_get(nspans);
+		pthread_mutex_unlock(&pool_lock);
+		if (sp == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		sp->owner = NULL;
+		sp->csize = 0;
+		return span_payload(sp);
+	}
+
+	size_t cls = size_class(nbytes);
+	Span *sp = hp->avail[cls];
+	if (sp == NULL) {
+		// new span for class
+		pthread_mutex_lock(&pool_lock);
+		sp = pool_get(1);
+		pthread_mutex_unlock(&pool_lock);
+		if (sp == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		sp->owner = hp;
+		sp->cls = cls;
+		sp->csize = class_size[cls];
+		sp->nused = 0;
+		sp->free = NULL;
+		sp->bump = (char *)sp + SPAN_HDR_SIZE;
+		avail_push(hp, sp);
+	}
+
+	Block *bp = sp->free;
+	if (bp != NULL) {
+		sp->free = bp->next;
+	} else {
+		bp = (Block *)sp->bump;
+		sp->bump += sp->csize;
+	}
+	sp->nused++;
+
+	// full span leaves class list until a block is freed
+	if (sp->free == NULL && sp->bump + sp->csize > (char *)sp + SPAN_SIZE) {
+		avail_remove(hp, sp);
+	}
+	return bp;
+}
+
+/**
+ * Deallocates the memory allocation pointed to by ap.
+ * If ap is NULL, no operation is performed. If ap is not
+ * in the heap or is a large block already free, no operation
+ * is performed and errno is set to EFAULT. A block freed by
+ * a thread other than the one that allocated it is queued
+ * for the allocating thread.
+ *
+ * @param ap the allocated storage to free
+ */
+void mm_free(void *ap) {
+	if (ap == NULL) {
+		return;
+	}
+	if (!in_pool(ap)) {
+		errno = EFAULT;  // bad address
+		return;
+	}
+
+	Span *sp = span_of(ap);
+	if (sp->csize == 0) {		// large run
+		if (sp->isfree || ap != span_payload(sp)) {
+			errno = EFAULT;
+			return;
+		}
+		pthread_mutex_lock(&pool_lock);
+		pool_put(sp);
+		pthread_mutex_unlock(&pool_lock);
+		return;
+	}
+
+	// a thread that has not allocated has no heap to free into,
+	// so its frees go to the owner like any other remote free
+	ThreadHeap *hp = current_heap();
+	if (hp != NULL && sp->owner == hp) {
+		free_local(hp, sp, ap);
+	} else {
+		remote_push(&sp->owner->remote, ap);
+	}
+}
+
+/**
+ * Reallocates size bytes of memory and returns a pointer
+ * to the allocated memory, or NULL if memory cannot be
+ * allocated.
+ *
+ * @param ap the currently allocated storage
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_realloc(void *ap, size_t nbytes) {
+	if (ap == NULL) {
+		return mm_malloc(nbytes);
+	}
+	if (!in_pool(ap)) {
+		errno = EFAULT;
+		return NULL;
+	}
+
+	// already enough space for request
+	size_t curbytes = usable_bytes(span_of(ap));
+	if (nbytes <= curbytes) {
+		return ap;
+	}
+
+	void *newap = mm_malloc(nbytes);
+	if (newap == NULL) {
+		return NULL;
+	}
+	memcpy(newap, ap, curbytes);
+	mm_free(ap);
+	return newap;
+}
+
+/**
+ * Print the pool of free span runs (educational purpose)
+ *
+ * @msg the initial message to print
+ */
+void visualize(const char* msg) {
+	fprintf(stderr, "\n--- Free span pool after \"%s\":\n", msg);
+	pthread_mutex_lock(&pool_lock);
+	for (Span *sp = pool; sp != NULL; sp = sp->next) {
+		fprintf(stderr, "    %p spans: %zu\n", (void *)sp, sp->nspans);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	fprintf(stderr, "--- end\n\n");
+}
+
+/**
+ * Calculate the total amount of free memory in the pool,
+ * not counting free blocks in thread heap spans.
+ *
+ * @return the amount of free memory in bytes
+ */
+size_t mm_getfree(void) {
+	size_t res = 0;
+	pthread_mutex_lock(&pool_lock);
+	for (Span *sp = pool; sp != NULL; sp = sp->next) {
+		res += sp->nspans * SPAN_SIZE;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return res;
+}
@@ -0,0 +1,172 @@
+/*
+ * size_classes.c
+ *
+ * Suggests a table of allocator size classes for a workload
+ * from an allocation profile written by "test_heap -p". The
+ * classes minimize the internal fragmentation, the bytes by
+ * which each request is rounded up to its class, for the
+ * requested size histogram in the profile.
+ *
+ * The sorted distinct sizes are partitioned into contiguous
+ * runs, each served by a class equal to the largest size in
+ * the run rounded up to the alignment. The optimal partition
+ * into n runs is found by dynamic programming.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+
+/**
+ * usage - Explain the command line arguments
+ */
+static void usage(void) {
+    fprintf(stderr, "Usage: size_classes [-h] [-n <classes>] [-a <align>] <prof>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h           Print this message.\n");
+    fprintf(stderr, "\t-n <classes> Number of size classes (default 8).\n");
+    fprintf(stderr, "\t-a <align>   Class size alignment in bytes (default max_align_t).\n");
+    fprintf(stderr, "\t<prof>       Profile written by test_heap -p.\n");
+}
+
+/** Distinct requested size and its count */
+typedef struct {
+	size_t size;
+	size_t count;
+} SizeCount;
+
+/**
+ * Round size up to a multiple of align.
+ */
+inline static size_t round_up(size_t size, size_t align) {
+	return (size + align - 1) / align * align;
+}
+
+/**
+ * Program reads a profile and prints suggested size classes.
+ * @param argc the argument count
+ * @param argv the argument array
+ */
+int main(int argc, char *argv[]) {
+	int c;
+	size_t nclasses = 8;
+	size_t align = sizeof(max_align_t);
+    while ((c = getopt(argc, argv, "hn:a:")) != EOF) {
+        switch (c) {
+        case 'n':
+        	nclasses = strtoul(optarg, NULL, 10);
+        	break;
+        case 'a':
+        	align = strtoul(optarg, NULL, 10);
+        	break;
+        case 'h': /* Print this message */
+        	usage();
+            return EXIT_SUCCESS;
+        default:
+        	usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc-1 || nclasses == 0 || align == 0) {
+    	usage();
+    	return EXIT_FAILURE;
+    }
+
+    FILE *fp = fopen(argv[optind], "r");
+    if (fp == NULL) {
+    	fprintf(stderr, "Missing profile file: %s\n", argv[optind]);
+    	return EXIT_FAILURE;
+    }
+
+    // read size records, which the profile lists in ascending order
+    size_t m = 0, cap = 256;
+    SizeCount *sc = malloc(cap * sizeof(SizeCount));
+    char type[16];
+    size_t bucket, count;
+    while (fscanf(fp, "%15s %zu %zu", type, &bucket, &count) == 3) {
+    	if (strcmp(type, "size") != 0) {
+    		continue;
+    	}
+    	if (m == cap) {
+    		cap *= 2;
+    		sc = realloc(sc, cap * sizeof(SizeCount));
+    	}
+    	sc[m].size = bucket;
+    	sc[m].count = count;
+    	m++;
+    }
+    fclose(fp);
+
+    if (m == 0) {
+    	fprintf(stderr, "No size records in profile file: %s\n", argv[optind]);
+    	return EXIT_FAILURE;
+    }
+    if (nclasses > m) {
+    	nclasses = m;
+    }
+
+    // prefix sums of counts and requested bytes; index 0 is empty
+    double *cnt = calloc(m+1, sizeof(double));
+    double *sum = calloc(m+1, sizeof(double));
+    for (size_t i = 1; i <= m; i++) {
+    	cnt[i] = cnt[i-1] + sc[i-1].count;
+    	sum[i] = sum[i-1] + (double)sc[i-1].size * sc[i-1].count;
+    }
+
+    // cost[k*(m+1)+j]: least waste for first j sizes with k classes
+    // from[k*(m+1)+j]: start of the last run in that solution
+    double *cost = malloc((nclasses+1) * (m+1) * sizeof(double));
+    size_t *from = malloc((nclasses+1) * (m+1) * sizeof(size_t));
+    for (size_t j = 0; j <= m; j++) {
+    	cost[j] = (j == 0) ? 0 : -1;		// -1 marks infeasible
+    }
+    for (size_t k = 1; k <= nclasses; k++) {
+    	double *prev = cost + (k-1)*(m+1);
+    	double *cur = cost + k*(m+1);
+    	cur[0] = -1;
+    	for (size_t j = 1; j <= m; j++) {
+    		double classsize = round_up(sc[j-1].size, align);
+    		cur[j] = -1;
+    		for (size_t i = 1; i <= j; i++) {	// run is sizes i..j
+    			if (prev[i-1] < 0) {
+    				continue;
+    			}
+    			double waste = classsize * (cnt[j]-cnt[i-1]) - (sum[j]-sum[i-1]);
+    			if (cur[j] < 0 || prev[i-1] + waste < cur[j]) {
+    				cur[j] = prev[i-1] + waste;
+    				from[k*(m+1)+j] = i;
+    			}
+    		}
+    	}
+    }
+
+    // recover the class boundaries from the last size backwards
+    size_t *last = malloc(nclasses * sizeof(size_t));
+    for (size_t k = nclasses, j = m; k > 0; k--) {
+    	last[k-1] = j;
+    	j = from[k*(m+1)+j] - 1;
+    }
+
+    printf("%5s%10s%12s%14s\n", "class", "bytes", "requests", "waste");
+    for (size_t k = 0, i = 1; k < nclasses; k++) {
+    	size_t j = last[k];
+    	double classsize = round_up(sc[j-1].size, align);
+    	double waste = classsize * (cnt[j]-cnt[i-1]) - (sum[j]-sum[i-1]);
+    	printf("%5zu%10.0f%12.0f%14.0f\n", k+1, classsize, cnt[j]-cnt[i-1], waste);
+    	i = j+1;
+    }
+    double total = cost[nclasses*(m+1)+m];
+    printf("internal fragmentation: %.0f of %.0f bytes (%.2f%%)\n",
+    		total, sum[m] + total, 100.0 * total / (sum[m] + total));
+
+    free(last);
+    free(from);
+    free(cost);
+    free(sum);
+    free(cnt);
+    free(sc);
+    return EXIT_SUCCESS;
+}
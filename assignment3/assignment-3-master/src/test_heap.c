@@ -10,19 +10,67 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 #include "mm_heap.h"
+#include "memlib.h"
+#ifdef MM_PROFILE
+#include "mm_profile.h"
+#endif
+
+/** Options and usage of features that are compiled in */
+#ifdef MM_PROFILE
+#define PROFILE_OPTS "p:"
+#define PROFILE_USAGE " [-p <prof>]"
+#else
+#define PROFILE_OPTS ""
+#define PROFILE_USAGE ""
+#endif
+#ifdef MM_SNAPSHOT
+#define SNAPSHOT_OPTS "s:i:"
+#define SNAPSHOT_USAGE " [-s <snap>] [-i <ops>]"
+#else
+#define SNAPSHOT_OPTS ""
+#define SNAPSHOT_USAGE ""
+#endif
+#ifdef MM_CHECKPOINT
+#define CHECKPOINT_OPTS "k:"
+#define CHECKPOINT_USAGE " [-k <ckpt>]"
+#else
+#define CHECKPOINT_OPTS ""
+#define CHECKPOINT_USAGE ""
+#endif
 
 /**
  * usage - Explain the command line arguments
  */
 static void usage(void) {
-    fprintf(stderr, "Usage: test_heap [-hvd]] <file1> [...<file>]\n");
+    fprintf(stderr, "Usage: test_heap [-hvdtHc]" PROFILE_USAGE SNAPSHOT_USAGE CHECKPOINT_USAGE
+            " <file1> [...<file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-v         Print detailed performance info.\n");
     fprintf(stderr, "\t-d         Print debug information.\n");
+    fprintf(stderr, "\t-t         Print dTLB misses per trace, where available.\n");
+    fprintf(stderr, "\t-H         Back the heap with transparent huge pages.\n");
+    fprintf(stderr, "\t-c         Print results to stdout as CSV.\n");
+#ifdef MM_PROFILE
+    fprintf(stderr, "\t-p <prof>  Write allocation profile to <prof> (- for stdout).\n");
+#endif
+#ifdef MM_SNAPSHOT
+    fprintf(stderr, "\t-s <snap>  Write heap snapshots to <snap> (- for stdout).\n");
+    fprintf(stderr, "\t-i <ops>   Snapshot every <ops> operations (default end of trace).\n");
+#endif
+#ifdef MM_CHECKPOINT
+    fprintf(stderr, "\t-k <ckpt>  Checkpoint heap to <ckpt> after first trace and\n");
+    fprintf(stderr, "\t           restore it instead of resetting after each trace.\n");
+#endif
     fprintf(stderr, "\t<file>     Use <file> as the trace file.\n");
 }
 
@@ -33,8 +81,67 @@ typedef struct {
 	int errors;
 	int ops;
 	float secs;
+	long long dtlb;		// dTLB misses or -1 if not counted
+	size_t peak;		// peak bytes allocated
+	size_t heapsize;	// heap size at end of trace or 0 if not in heap
 } TraceInfo;
 
+/**
+ * Open a counter for dTLB read misses of this process.
+ *
+ * @return the counter file descriptor or -1 if not available
+ */
+static int open_dtlb_counter(void) {
+#ifdef __linux__
+	struct perf_event_attr pe;
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HW_CACHE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_CACHE_DTLB
+			  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	return (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+/**
+ * Reset and start counting.
+ *
+ * @param fd the counter file descriptor
+ */
+static void start_counter(int fd) {
+#ifdef __linux__
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+/**
+ * Stop counting and read the count.
+ *
+ * @param fd the counter file descriptor
+ * @return the count or -1 if not available
+ */
+static long long stop_counter(int fd) {
+	long long count = -1;
+#ifdef __linux__
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+			count = -1;
+		}
+	}
+#endif
+	return count;
+}
+
 /**
  * Program processes trace files.
  * @param argc the argument count
@@ -44,11 +151,54 @@ int main(int argc, char *argv[]) {
 	char c;
 	bool verbose = false;
 	bool debug = false;
-    while ((c = getopt(argc, argv, "dhv")) != EOF) {
+	bool tlb = false;
+	bool csv = false;
+#ifdef MM_PROFILE
+	char *proffile = NULL;
+#endif
+#ifdef MM_SNAPSHOT
+	FILE *snapfp = NULL;
+	int snapinterval = 0;
+#endif
+#ifdef MM_CHECKPOINT
+	char *ckptfile = NULL;
+#endif
+    while ((c = getopt(argc, argv, "dhvtHc" PROFILE_OPTS SNAPSHOT_OPTS CHECKPOINT_OPTS)) != EOF) {
         switch (c) {
+        case 't': /* Print dTLB misses */
+        	tlb = true;
+        	break;
+        case 'H': /* Back heap with huge pages */
+        	mem_set_hugepage(true);
+        	break;
+        case 'c': /* Print results as CSV */
+        	csv = true;
+        	break;
         case 'd':
         	debug = true;
         	break;
+#ifdef MM_PROFILE
+        case 'p': /* Write allocation profile */
+        	proffile = optarg;
+        	break;
+#endif
+#ifdef MM_SNAPSHOT
+        case 's': /* Write heap snapshots */
+        	snapfp = (strcmp(optarg, "-") == 0) ? stdout : fopen(optarg, "w");
+        	if (snapfp == NULL) {
+        		fprintf(stderr, "Cannot write snapshot file: %s\n", optarg);
+        		return EXIT_FAILURE;
+        	}
+        	break;
+        case 'i': /* Snapshot interval */
+        	snapinterval = atoi(optarg);
+        	break;
+#endif
+#ifdef MM_CHECKPOINT
+        case 'k': /* Checkpoint after first trace */
+        	ckptfile = optarg;
+        	break;
+#endif
         case 'v': /* Print per-trace performance breakdown */
             verbose = true;
             break;
@@ -71,6 +221,13 @@ int main(int argc, char *argv[]) {
     // init memory model with default size
     mm_init();
 
+    // dTLB misses are counted over each trace replay, including the
+    // harness touching the blocks, which also depends on page size
+    int dtlbfd = tlb ? open_dtlb_counter() : -1;
+    if (tlb && dtlbfd < 0) {
+    	fprintf(stderr, "dTLB miss counter not available\n");
+    }
+
     // allocate array for trace results
     TraceInfo results[argc-optind];
 
@@ -109,11 +266,15 @@ int main(int argc, char *argv[]) {
 		int max_index = num_ids-1;
 		int size;
 		char type[2];
-		bool nerrors = 0;
+		int nerrors = 0;
+		size_t nbytes = 0;		// bytes currently allocated
+		size_t peak = 0;
 		clock_t elapsed_time = 0;
 		if (debug || verbose) fprintf(stderr, "Processing trace file %s\n",
 				results[traceindex].traceName);
 
+		start_counter(dtlbfd);
+
 		while (fscanf(tracefile, "%s", type) != EOF) {
 			switch(type[0]) {
 			case 'a':
@@ -138,6 +299,7 @@ int main(int argc, char *argv[]) {
 						 */
 						memset(blocks[index], (index & 0xFF), size);
 						block_sizes[index] = size;
+						nbytes += size;
 					}
 				}
 				break;
@@ -169,7 +331,8 @@ int main(int argc, char *argv[]) {
 					} else {
 						if (debug && verbose) fprintf(stderr, "  Reallocated block %u size %u\n", index, size);
 						blocks[index] = b;
-						for (int i = 0; i < block_sizes[index]; i++) {
+						// only the part kept by a shrinking realloc is preserved
+						for (int i = 0; i < block_sizes[index] && i < size; i++) {
 							if (*((char*)blocks[index]+i) != (char)(index & 0xFF)) {
 								if (debug) fprintf(stderr, "  Block %u has unexpected data after reallocation.\n", index);
 								nerrors++;
@@ -181,6 +344,7 @@ int main(int argc, char *argv[]) {
 						 * data was copied to the new block on realloc or free
 						 */
 						memset(blocks[index], (index & 0xFF), size);
+						nbytes += size - block_sizes[index];
 						block_sizes[index] = size;
 					}
 				}
@@ -199,10 +363,21 @@ int main(int argc, char *argv[]) {
 							break;
 						}
 					}
+					errno = 0;
 					time_t t = clock();
+#ifdef MM_SIZED_FREE
+					mm_free_sized(blocks[index], block_sizes[index]);
+#else
 					mm_free(blocks[index]);
+#endif
 					elapsed_time += clock()-t;
+					if (errno == EFAULT) {
+						// allocator did not recognize its own block
+						if (debug) fprintf(stderr, "  Block %u not freed\n", index);
+						nerrors++;
+					}
 					if (debug & verbose) fprintf(stderr, "  Freed block %u size %zu\n", index, block_sizes[index]);
+					nbytes -= block_sizes[index];
 					blocks[index] = NULL;
 					block_sizes[index] = 0;
 				}
@@ -213,8 +388,17 @@ int main(int argc, char *argv[]) {
 				nerrors++;
 			}
 
+			peak = (nbytes > peak) ? nbytes : peak;
 			op_index++;
+#ifdef MM_SNAPSHOT
+			if (snapfp != NULL && snapinterval > 0 && op_index % snapinterval == 0) {
+				char label[256];
+				snprintf(label, sizeof(label), "%s:%d", results[traceindex].traceName, op_index);
+				mm_snapshot(snapfp, label);
+			}
+#endif
 		}
+		results[traceindex].dtlb = stop_counter(dtlbfd);
 		fclose(tracefile);
 
 		if (debug || verbose) fprintf(stderr, "Done processing trace file %s\n",
@@ -225,6 +409,8 @@ int main(int argc, char *argv[]) {
 
 		results[traceindex].leaks = 0;
 		results[traceindex].errors = nerrors;
+		results[traceindex].peak = peak;
+		results[traceindex].heapsize = mem_heapsize();
 
 		// tally and report leaks
 		char *newline = "\n";
@@ -242,26 +428,104 @@ int main(int argc, char *argv[]) {
 		results[traceindex].secs = ((double) (elapsed_time)) / CLOCKS_PER_SEC;
 		results[traceindex].ops = op_index;
 
+#ifdef MM_SNAPSHOT
+		// snapshot at end of trace unless one was just taken
+		if (snapfp != NULL && (snapinterval <= 0 || op_index % snapinterval != 0)) {
+			char label[256];
+			snprintf(label, sizeof(label), "%s:%d", results[traceindex].traceName, op_index);
+			mm_snapshot(snapfp, label);
+		}
+#endif
+
+#ifdef MM_CHECKPOINT
+		// first trace warms the heap for the following traces
+		if (ckptfile != NULL) {
+			if (traceindex == 0 && !mm_checkpoint(ckptfile)) {
+				fprintf(stderr, "Cannot write checkpoint file: %s\n", ckptfile);
+				ckptfile = NULL;
+			} else {
+				clock_t t = clock();
+				if (mm_restore(ckptfile)) {
+					if (verbose) fprintf(stderr, "Restored checkpoint in %.3f ms\n\n",
+										 1e3 * (clock()-t) / CLOCKS_PER_SEC);
+					continue;
+				}
+				fprintf(stderr, "Cannot restore checkpoint file: %s\n", ckptfile);
+			}
+		}
+#endif
+
 		// reset memory model for next test
 		mm_reset();
 	}
 
 
     /* Print the individual results for each trace */
+    if (csv) {
+    	// utilization is peak bytes allocated over heap size
+    	printf("trace,ops,errors,leaks,secs,kops,util\n");
+    	for (int i = 0; i < traceindex; i++) {
+    		if (results[i].ops > 0) {
+    			printf("%s,%d,%d,%d,%.6f,%d,", results[i].traceName, results[i].ops,
+    					results[i].errors, results[i].leaks, results[i].secs,
+    					(int)(results[i].ops/1e3/results[i].secs));
+    			if (results[i].heapsize > 0) {
+    				printf("%.1f", 100.0 * results[i].peak / results[i].heapsize);
+    			}
+    			printf("\n");
+    		}
+    	}
+    }
+
     if (verbose) fprintf(stderr, "\nResults for traces:\n");
-	fprintf(stderr, "%5s%7s%7s%8s%10s%8s  %s\n",
-	   "index", "leaks", "errors", "ops", "secs", "Kops", "file");
+	fprintf(stderr, "%5s%7s%7s%8s%10s%8s%7s", "index", "leaks", "errors", "ops", "secs", "Kops", "util");
+	if (dtlbfd >= 0) {
+		fprintf(stderr, "%12s", "dTLB-miss");
+	}
+	fprintf(stderr, "  %s\n", "file");
 
     for (int i = 0; i < traceindex; i++) {
     	if (results[i].ops > 0) {
-			fprintf(stderr, "%5d%7d%7d%8d%10.6f%8d  %s\n",
+			fprintf(stderr, "%5d%7d%7d%8d%10.6f%8d",
 					i+1, results[i].leaks, results[i].errors, results[i].ops, results[i].secs,
-					(int)(results[i].ops/1e3/results[i].secs), results[i].traceName);
+					(int)(results[i].ops/1e3/results[i].secs));
+			if (results[i].heapsize > 0) {
+				fprintf(stderr, "%6.1f%%", 100.0 * results[i].peak / results[i].heapsize);
+			} else {
+				fprintf(stderr, "%7s", "-");
+			}
+			if (dtlbfd >= 0) {
+				fprintf(stderr, "%12lld", results[i].dtlb);
+			}
+			fprintf(stderr, "  %s\n", results[i].traceName);
     	}
     }
+    if (dtlbfd >= 0) {
+    	close(dtlbfd);
+    }
 
     // deinitialize memory model
     mm_deinit();
 
+#ifdef MM_SNAPSHOT
+    if (snapfp != NULL && snapfp != stdout) {
+    	fclose(snapfp);
+    }
+#endif
+
+#ifdef MM_PROFILE
+    if (proffile != NULL) {
+    	FILE *proffp = (strcmp(proffile, "-") == 0) ? stdout : fopen(proffile, "w");
+    	if (proffp == NULL) {
+    		fprintf(stderr, "Cannot write profile file: %s\n", proffile);
+    		return EXIT_FAILURE;
+    	}
+    	mm_prof_dump(proffp);
+    	if (proffp != stdout) {
+    		fclose(proffp);
+    	}
+    }
+#endif
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,263 @@
+/*
+ * test_thread_heap.c
+ *
+ * Multithreaded driver for the thread-aware allocator. Producer
+ * threads allocate blocks, fill them with a pattern, and pass
+ * them through a ring to consumer threads, which check the
+ * pattern and free or reallocate the blocks. Almost every small
+ * block is therefore freed by a thread other than the one that
+ * allocated it and goes through the owner's remote free queue.
+ *
+ * Producers run in waves. Consumers outlive each wave, so blocks
+ * of a wave are freed onto the queues of heaps whose threads have
+ * exited, and the next wave adopts those heaps and drains them.
+ * The heap size is printed after each wave; it stops growing
+ * once freed spans are being reused.
+ *
+ * Build with -fsanitize=thread (make test_thread_heap_tsan) to
+ * check the queues for data races.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "mm_heap.h"
+#include "memlib.h"
+
+/** Capacity of the producer/consumer ring */
+#define RING_SIZE 256
+
+/** Largest block a producer allocates; larger than a small class */
+#define MAX_BLOCK 3000
+
+/** A block passed from a producer to a consumer */
+typedef struct {
+	unsigned char *ap;		// block or NULL to stop the consumer
+	size_t nbytes;			// requested size
+	unsigned char fill;		// byte pattern
+} Item;
+
+/** Bounded ring of blocks protected by a mutex */
+static struct {
+	Item items[RING_SIZE];
+	size_t head, len;
+	pthread_mutex_t lock;
+	pthread_cond_t notfull, notempty;
+} ring = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.notfull = PTHREAD_COND_INITIALIZER,
+	.notempty = PTHREAD_COND_INITIALIZER
+};
+
+/** Blocks per producer */
+static int nblocks = 20000;
+
+/** Number of blocks that failed a check */
+static int errors = 0;
+static pthread_mutex_t errors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * usage - Explain the command line arguments
+ */
+static void usage(void) {
+	fprintf(stderr, "Usage: test_thread_heap [-h] [-p <n>] [-c <n>] [-w <n>] [-n <n>]\n");
+	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-h      Print this message.\n");
+	fprintf(stderr, "\t-p <n>  Producer threads per wave (default 4).\n");
+	fprintf(stderr, "\t-c <n>  Consumer threads (default 4).\n");
+	fprintf(stderr, "\t-w <n>  Waves of producers (default 4).\n");
+	fprintf(stderr, "\t-n <n>  Blocks allocated by each producer (default 20000).\n");
+}
+
+/**
+ * Add a block to the ring, waiting while it is full.
+ *
+ * @param item the block
+ */
+static void ring_put(Item item) {
+	pthread_mutex_lock(&ring.lock);
+	while (ring.len == RING_SIZE) {
+		pthread_cond_wait(&ring.notfull, &ring.lock);
+	}
+	ring.items[(ring.head + ring.len++) % RING_SIZE] = item;
+	pthread_cond_signal(&ring.notempty);
+	pthread_mutex_unlock(&ring.lock);
+}
+
+/**
+ * Take a block from the ring, waiting while it is empty.
+ *
+ * @return the block
+ */
+static Item ring_get(void) {
+	pthread_mutex_lock(&ring.lock);
+	while (ring.len == 0) {
+		pthread_cond_wait(&ring.notempty, &ring.lock);
+	}
+	Item item = ring.items[ring.head];
+	ring.head = (ring.head + 1) % RING_SIZE;
+	ring.len--;
+	pthread_cond_signal(&ring.notfull);
+	pthread_mutex_unlock(&ring.lock);
+	return item;
+}
+
+/**
+ * Check that a block still holds its pattern, counting an
+ * error if it does not.
+ *
+ * @param item the block
+ * @param who the checking thread, for the message
+ */
+static void check(Item item, const char *who) {
+	for (size_t i = 0; i < item.nbytes; i++) {
+		if (item.ap[i] != item.fill) {
+			fprintf(stderr, "%s: block %p byte %zu is %#x, expected %#x\n",
+					who, (void *)item.ap, i, item.ap[i], item.fill);
+			pthread_mutex_lock(&errors_lock);
+			errors++;
+			pthread_mutex_unlock(&errors_lock);
+			return;
+		}
+	}
+}
+
+/**
+ * Next value of a per-thread xorshift generator.
+ *
+ * @param seed the generator state
+ */
+static uint32_t next_rand(uint32_t *seed) {
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+/**
+ * Allocate nblocks blocks, freeing about one in eight locally
+ * and passing the rest to consumers.
+ *
+ * @param arg the producer number
+ */
+static void *producer(void *arg) {
+	uint32_t seed = 2463534242u + (uint32_t)(uintptr_t)arg * 7919;
+	for (int n = 0; n < nblocks; n++) {
+		uint32_t r = next_rand(&seed);
+		Item item;
+		item.nbytes = 1 + r % ((r & 0xf00) == 0 ? MAX_BLOCK : 256);
+		item.fill = (unsigned char)(r >> 24);
+		item.ap = mm_malloc(item.nbytes);
+		if (item.ap == NULL) {
+			fprintf(stderr, "producer: out of memory\n");
+			break;
+		}
+		memset(item.ap, item.fill, item.nbytes);
+		if (r % 8 == 0) {
+			check(item, "producer");
+			mm_free(item.ap);
+		} else {
+			ring_put(item);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Check and free blocks from the ring until told to stop,
+ * growing about one in sixteen with mm_realloc() first.
+ * Consumer 0 only frees, so it never has a heap of its own.
+ *
+ * @param arg the consumer number
+ */
+static void *consumer(void *arg) {
+	uint32_t seed = 88675123u + (uint32_t)(uintptr_t)arg * 104729;
+	for (;;) {
+		Item item = ring_get();
+		if (item.ap == NULL) {
+			break;
+		}
+		check(item, "consumer");
+		if (arg != 0 && next_rand(&seed) % 16 == 0) {
+			unsigned char *ap = mm_realloc(item.ap, item.nbytes * 2);
+			if (ap == NULL) {
+				fprintf(stderr, "consumer: out of memory\n");
+			} else {
+				item.ap = ap;
+				check(item, "consumer realloc");
+			}
+		}
+		mm_free(item.ap);
+	}
+	return NULL;
+}
+
+/**
+ * Program runs waves of producers against a set of consumers.
+ * @param argc the argument count
+ * @param argv the argument array
+ */
+int main(int argc, char *argv[]) {
+	int c;
+	int nproducers = 4, nconsumers = 4, nwaves = 4;
+	while ((c = getopt(argc, argv, "hp:c:w:n:")) != EOF) {
+		switch (c) {
+		case 'p':
+			nproducers = atoi(optarg);
+			break;
+		case 'c':
+			nconsumers = atoi(optarg);
+			break;
+		case 'w':
+			nwaves = atoi(optarg);
+			break;
+		case 'n':
+			nblocks = atoi(optarg);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (nproducers <= 0 || nconsumers <= 0 || nwaves <= 0 || nblocks < 0) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	mm_init();
+
+	pthread_t consumers[nconsumers], producers[nproducers];
+	for (int i = 0; i < nconsumers; i++) {
+		pthread_create(&consumers[i], NULL, consumer, (void *)(uintptr_t)i);
+	}
+
+	for (int w = 0; w < nwaves; w++) {
+		for (int i = 0; i < nproducers; i++) {
+			pthread_create(&producers[i], NULL, producer,
+						   (void *)(uintptr_t)(w * nproducers + i));
+		}
+		for (int i = 0; i < nproducers; i++) {
+			pthread_join(producers[i], NULL);
+		}
+		printf("wave %d: heap %zu bytes, pool free %zu bytes\n",
+			   w, mem_heapsize(), mm_getfree());
+	}
+
+	for (int i = 0; i < nconsumers; i++) {
+		ring_put((Item){ .ap = NULL });
+	}
+	for (int i = 0; i < nconsumers; i++) {
+		pthread_join(consumers[i], NULL);
+	}
+
+	mm_deinit();
+	printf("%d errors\n", errors);
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -14,16 +14,47 @@ struct blkdev {
     void *private;
 };
 
+/* an asynchronous request. The caller owns the request and its buffer
+ * until 'done' is called, with 'result' set to SUCCESS or an error.
+ */
+struct blkdev_req {
+    int   op;                   /* BLKDEV_READ or BLKDEV_WRITE */
+    int   first_blk;
+    int   num_blks;
+    void *buf;
+    int   result;
+    void (*done)(struct blkdev_req *req);
+    void *arg;                  /* for the caller's use */
+};
+
 struct blkdev_ops {
     int  (*num_blocks)(struct blkdev *dev);
     int  (*read)(struct blkdev *dev, int first_blk, int num_blks, void *buf);
     int  (*write)(struct blkdev *dev, int first_blk, int num_blks, void *buf);
     int  (*flush)(struct blkdev *dev, int first_blk, int num_blks);
     void (*close)(struct blkdev *dev);
+    /* optional, NULL for synchronous-only devices. submit queues a
+     * request without waiting for it; wait completes at least 'min'
+     * outstanding requests (0 just polls) and returns how many it
+     * completed. Outstanding requests may complete in any order.
+     */
+    int  (*submit)(struct blkdev *dev, struct blkdev_req *req);
+    int  (*wait)(struct blkdev *dev, int min);
 };
 
 enum {SUCCESS = 0, E_BADADDR = -1, E_UNAVAIL = -2, E_SIZE = -3};
+enum {BLKDEV_READ = 0, BLKDEV_WRITE = 1};
+
+/* submit and wait for any device - without submit, the request is
+ * carried out with read or write and 'done' is called before
+ * blkdev_submit returns.
+ */
+extern int blkdev_submit(struct blkdev *dev, struct blkdev_req *req);
+extern int blkdev_wait(struct blkdev *dev, int min);
 
 extern struct blkdev *image_create(char *path);
+extern struct blkdev *image_mmap_create(char *path);
+extern struct blkdev *image_uring_create(char *path, int depth);
+extern struct blkdev *cache_create(struct blkdev *disk, int nblks);
 
 #endif
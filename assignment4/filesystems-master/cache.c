@@ -0,0 +1,364 @@
+/*
+ * file:        cache.c
+ * description: write-back buffer cache for CS 5600/7600 file system
+ *
+ * A cache blkdev sits in front of another blkdev (normally one from
+ * image_create) and keeps the most recently used blocks in memory.
+ * Blocks are found through a hash table on block number and evicted
+ * in LRU order. Writes only update the cached copy and mark it dirty;
+ * dirty blocks go to the underlying device when they are evicted or
+ * when the cache is flushed, with runs of consecutive dirty blocks
+ * written in a single request. On a device with asynchronous requests
+ * a flush submits all of its runs before waiting for any of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "blkdev.h"
+
+#define MAX_RUN 64              /* blocks per write-back request */
+
+struct cache_buf {
+    int   blk;                  /* block number, -1 if unused */
+    int   dirty;
+    struct cache_buf *hnext;    /* hash chain */
+    struct cache_buf *prev;     /* LRU list, most recent first */
+    struct cache_buf *next;
+    char  data[BLOCK_SIZE];
+};
+
+struct cache_dev {
+    struct blkdev    *disk;     /* underlying device */
+    int               nbufs;
+    int               nbuckets;
+    struct cache_buf *bufs;
+    struct cache_buf **hash;
+    struct cache_buf  lru;      /* list head; lru.prev is the victim */
+    char             *runbuf;   /* MAX_RUN blocks for write-back */
+};
+
+/* LRU list and hash table maintenance.
+ */
+static void lru_unlink(struct cache_buf *b)
+{
+    b->prev->next = b->next;
+    b->next->prev = b->prev;
+}
+
+static void lru_push(struct cache_dev *c, struct cache_buf *b)
+{
+    b->next = c->lru.next;
+    b->prev = &c->lru;
+    c->lru.next->prev = b;
+    c->lru.next = b;
+}
+
+static struct cache_buf **hash_slot(struct cache_dev *c, int blk)
+{
+    return &c->hash[(unsigned)blk % c->nbuckets];
+}
+
+static struct cache_buf *cache_lookup(struct cache_dev *c, int blk)
+{
+    struct cache_buf *b;
+    for (b = *hash_slot(c, blk); b != NULL; b = b->hnext)
+        if (b->blk == blk)
+            return b;
+    return NULL;
+}
+
+static void hash_remove(struct cache_dev *c, struct cache_buf *b)
+{
+    struct cache_buf **pp = hash_slot(c, b->blk);
+    while (*pp != b)
+        pp = &(*pp)->hnext;
+    *pp = b->hnext;
+}
+
+/* write back dirty buffers, which must be for consecutive blocks
+ * starting at bufs[0]->blk, in a single request.
+ */
+static int write_run(struct cache_dev *c, struct cache_buf **bufs, int n)
+{
+    int i, val;
+    for (i = 0; i < n; i++)
+        memcpy(c->runbuf + i*BLOCK_SIZE, bufs[i]->data, BLOCK_SIZE);
+    val = c->disk->ops->write(c->disk, bufs[0]->blk, n, c->runbuf);
+    if (val < 0)
+        return val;
+    for (i = 0; i < n; i++)
+        bufs[i]->dirty = 0;
+    return SUCCESS;
+}
+
+/* write back dirty buffer 'b' together with the dirty buffers for the
+ * blocks after it, so that evicting blocks written sequentially takes
+ * one request per run rather than one per block.
+ */
+static int write_cluster(struct cache_dev *c, struct cache_buf *b)
+{
+    struct cache_buf *run[MAX_RUN];
+    int n = 0;
+
+    run[n++] = b;
+    while (n < MAX_RUN && (b = cache_lookup(c, run[0]->blk + n)) != NULL && b->dirty)
+        run[n++] = b;
+    return write_run(c, run, n);
+}
+
+/* take the least recently used buffer for block 'blk', writing back
+ * its old contents if dirty. The buffer is returned at the head of
+ * the LRU list with undefined data.
+ */
+static struct cache_buf *cache_alloc(struct cache_dev *c, int blk, int *err)
+{
+    struct cache_buf *b = c->lru.prev;
+
+    if (b->dirty && (*err = write_cluster(c, b)) < 0)
+        return NULL;
+    if (b->blk != -1)
+        hash_remove(c, b);
+
+    b->blk = blk;
+    struct cache_buf **pp = hash_slot(c, blk);
+    b->hnext = *pp;
+    *pp = b;
+    lru_unlink(b);
+    lru_push(c, b);
+    return b;
+}
+
+/* The blkdev operations - num_blocks, read, write, flush and close.
+ */
+static int cache_num_blocks(struct blkdev *dev)
+{
+    struct cache_dev *c = dev->private;
+    return c->disk->ops->num_blocks(c->disk);
+}
+
+static int cache_read(struct blkdev *dev, int first_blk, int num_blks, void *buf)
+{
+    struct cache_dev *c = dev->private;
+    char *p = buf;
+    int i, j, val;
+
+    if (first_blk < 0 || first_blk + num_blks > cache_num_blocks(dev))
+        return E_BADADDR;
+
+    for (i = 0; i < num_blks; ) {
+        struct cache_buf *b = cache_lookup(c, first_blk + i);
+        if (b != NULL) {
+            memcpy(p + i*BLOCK_SIZE, b->data, BLOCK_SIZE);
+            lru_unlink(b);
+            lru_push(c, b);
+            i++;
+            continue;
+        }
+
+        /* read a run of missing blocks straight into the caller's
+         * buffer, then keep copies of them.
+         */
+        for (j = i+1; j < num_blks && cache_lookup(c, first_blk + j) == NULL; j++)
+            ;
+        val = c->disk->ops->read(c->disk, first_blk + i, j - i, p + i*BLOCK_SIZE);
+        if (val < 0)
+            return val;
+        for (; i < j; i++) {
+            if ((b = cache_alloc(c, first_blk + i, &val)) == NULL)
+                return val;
+            memcpy(b->data, p + i*BLOCK_SIZE, BLOCK_SIZE);
+        }
+    }
+    return SUCCESS;
+}
+
+static int cache_write(struct blkdev *dev, int first_blk, int num_blks, void *buf)
+{
+    struct cache_dev *c = dev->private;
+    char *p = buf;
+    int i, val;
+
+    if (first_blk < 0 || first_blk + num_blks > cache_num_blocks(dev))
+        return E_BADADDR;
+
+    for (i = 0; i < num_blks; i++) {
+        struct cache_buf *b = cache_lookup(c, first_blk + i);
+        if (b != NULL) {
+            lru_unlink(b);
+            lru_push(c, b);
+        }
+        else if ((b = cache_alloc(c, first_blk + i, &val)) == NULL)
+            return val;
+        memcpy(b->data, p + i*BLOCK_SIZE, BLOCK_SIZE);
+        b->dirty = 1;
+    }
+    return SUCCESS;
+}
+
+static int cmp_blk(const void *a, const void *b)
+{
+    const struct cache_buf *x = *(struct cache_buf **)a;
+    const struct cache_buf *y = *(struct cache_buf **)b;
+    return x->blk - y->blk;
+}
+
+/* completion for the write-back requests of a flush
+ */
+struct flush_state {
+    int pending;
+    int err;
+};
+
+static void flush_done(struct blkdev_req *req)
+{
+    struct flush_state *f = req->arg;
+    if (req->result < 0)
+        f->err = req->result;
+    f->pending--;
+}
+
+/* flush without allocating: write back the dirty blocks in the range
+ * one run at a time, as eviction does.
+ */
+static int flush_sync(struct cache_dev *c, int first_blk, int num_blks)
+{
+    int i, val;
+
+    for (i = 0; i < c->nbufs; i++) {
+        struct cache_buf *b = &c->bufs[i];
+        if (b->dirty && b->blk >= first_blk && b->blk < first_blk + num_blks &&
+            (val = write_cluster(c, b)) < 0)
+            return val;
+    }
+    return c->disk->ops->flush(c->disk, first_blk, num_blks);
+}
+
+/* write back all dirty blocks in the range in block order, then
+ * flush the underlying device. The blocks are copied out so that
+ * every run can be in flight at once; if there is no memory for
+ * that, fall back to flush_sync.
+ */
+static int cache_flush(struct blkdev *dev, int first_blk, int num_blks)
+{
+    struct cache_dev *c = dev->private;
+    struct cache_buf **dirty = malloc(c->nbufs * sizeof(*dirty));
+    int i, j, n = 0, val;
+
+    if (dirty == NULL)
+        return flush_sync(c, first_blk, num_blks);
+    for (i = 0; i < c->nbufs; i++) {
+        struct cache_buf *b = &c->bufs[i];
+        if (b->dirty && b->blk >= first_blk && b->blk < first_blk + num_blks)
+            dirty[n++] = b;
+    }
+    qsort(dirty, n, sizeof(*dirty), cmp_blk);
+
+    char *data = malloc((size_t)n * BLOCK_SIZE);
+    struct blkdev_req *reqs = malloc(n * sizeof(*reqs));
+    if (data == NULL || reqs == NULL) {
+        free(reqs);
+        free(data);
+        free(dirty);
+        return flush_sync(c, first_blk, num_blks);
+    }
+    struct flush_state f = {.pending = 0, .err = SUCCESS};
+    for (i = 0; i < n; i++)
+        memcpy(data + i*BLOCK_SIZE, dirty[i]->data, BLOCK_SIZE);
+
+    for (i = 0; i < n && f.err == SUCCESS; i = j) {
+        for (j = i+1; j < n && j - i < MAX_RUN &&
+                 dirty[j]->blk == dirty[j-1]->blk + 1; j++)
+            ;
+        struct blkdev_req *req = &reqs[i];
+        *req = (struct blkdev_req){.op = BLKDEV_WRITE, .first_blk = dirty[i]->blk,
+                                   .num_blks = j - i, .buf = data + i*BLOCK_SIZE,
+                                   .done = flush_done, .arg = &f};
+        f.pending++;
+        if ((val = blkdev_submit(c->disk, req)) < 0) {
+            f.pending--;
+            f.err = val;
+        }
+    }
+    while (f.pending > 0)
+        blkdev_wait(c->disk, 1);
+
+    if (f.err == SUCCESS)
+        for (i = 0; i < n; i++)
+            dirty[i]->dirty = 0;
+    free(reqs);
+    free(data);
+    free(dirty);
+
+    if (f.err < 0)
+        return f.err;
+    return c->disk->ops->flush(c->disk, first_blk, num_blks);
+}
+
+static void cache_close(struct blkdev *dev)
+{
+    struct cache_dev *c = dev->private;
+
+    cache_flush(dev, 0, cache_num_blocks(dev));
+    c->disk->ops->close(c->disk);
+    free(c->bufs);
+    free(c->hash);
+    free(c->runbuf);
+    free(c);
+    dev->private = NULL;        /* crash any attempts to access */
+    free(dev);
+}
+
+struct blkdev_ops cache_ops = {
+    .num_blocks = cache_num_blocks,
+    .read = cache_read,
+    .write = cache_write,
+    .flush = cache_flush,
+    .close = cache_close
+};
+
+/* create a cache blkdev holding up to 'nblks' blocks of 'disk'. Closing
+ * it writes back any dirty blocks and closes 'disk'.
+ */
+struct blkdev *cache_create(struct blkdev *disk, int nblks)
+{
+    struct blkdev *dev = malloc(sizeof(*dev));
+    struct cache_dev *c = malloc(sizeof(*c));
+    int i;
+
+    if (dev == NULL || c == NULL || nblks <= 0) {
+        free(dev);
+        free(c);
+        return NULL;
+    }
+
+    c->disk = disk;
+    c->nbufs = nblks;
+    c->nbuckets = nblks;
+    c->bufs = malloc(nblks * sizeof(*c->bufs));
+    c->hash = calloc(c->nbuckets, sizeof(*c->hash));
+    c->runbuf = malloc(MAX_RUN * BLOCK_SIZE);
+    if (c->bufs == NULL || c->hash == NULL || c->runbuf == NULL) {
+        free(c->bufs);
+        free(c->hash);
+        free(c->runbuf);
+        free(c);
+        free(dev);
+        return NULL;
+    }
+
+    /* all buffers start out unused on the LRU list */
+    c->lru.next = c->lru.prev = &c->lru;
+    for (i = 0; i < nblks; i++) {
+        c->bufs[i].blk = -1;
+        c->bufs[i].dirty = 0;
+        lru_push(c, &c->bufs[i]);
+    }
+
+    dev->private = c;
+    dev->ops = &cache_ops;
+
+    return dev;
+}
@@ -34,6 +34,37 @@ struct fs_super {
     char pad[FS_BLOCK_SIZE - 6 * sizeof(uint32_t)]; 
 };
 
+/* Extent-mapped files (flag FS_EXTENTS) - instead of block pointers
+ * the inode describes the file as runs of consecutive blocks, each
+ * mapping logical blocks 'lblk' to 'lblk'+'len'-1 to physical blocks
+ * starting at 'pblk'. Extents are sorted by 'lblk' and there are no
+ * holes below the end of the file.
+ *
+ * Up to N_EXTENTS extents ('n_extents' of them) are kept in the inode
+ * itself. Beyond that they move to an extent tree rooted at block
+ * 'ext_tree'. With 'ext_depth' 0 the root is a leaf of extents; with
+ * 'ext_depth' 1 it is an index whose entries give the first logical
+ * block ('lblk') and the leaf block ('pblk') for each leaf, with 'len'
+ * unused.
+ */
+#define FS_EXTENTS 2
+
+struct fs_extent {
+    uint32_t lblk;
+    uint32_t pblk;
+    uint32_t len;
+};
+
+#define N_EXTENTS 2
+
+struct fs_ext_node {
+    uint32_t count;             /* entries in use */
+    uint32_t pad;
+    struct fs_extent entries[(FS_BLOCK_SIZE - 8) / sizeof(struct fs_extent)];
+};
+
+enum {EXT_ENTRIES = (FS_BLOCK_SIZE - 8) / sizeof(struct fs_extent)};
+
 #define N_DIRECT 6
 struct fs_inode {
     uint16_t uid;
@@ -42,14 +73,53 @@ struct fs_inode {
     uint32_t ctime;
     uint32_t mtime;
      int32_t size;
-    uint32_t direct[N_DIRECT];
-    uint32_t indir_1;
-    uint32_t indir_2;
-    uint32_t pad[3];            /* 64 bytes per inode */
+    union {
+        struct {                /* block pointers */
+            uint32_t direct[N_DIRECT];
+            uint32_t indir_1;
+            uint32_t indir_2;
+        };
+        struct {                /* flag FS_EXTENTS, see below */
+            struct fs_extent extents[N_EXTENTS];
+            uint16_t n_extents;
+            uint16_t ext_depth;
+            uint32_t ext_tree;
+        };
+    };
+    uint32_t flags;             /* FS_* below */
+    uint32_t pad[2];            /* 64 bytes per inode */
 };
 
 enum {INODES_PER_BLK = FS_BLOCK_SIZE / sizeof(struct fs_inode)};
 
+/* Indexed directories (flag FS_DIR_INDEX) - a directory starts out
+ * as the single block of entries in direct[0]. When that fills, it
+ * becomes indexed: logical block 0 (direct[0]) holds the root of a
+ * hash index and entries are kept in leaf blocks elsewhere in the
+ * directory, found through the inode's block pointers like file
+ * data. 'size' is then the number of blocks times FS_BLOCK_SIZE.
+ *
+ * Each index entry covers the name hashes from its 'hash' up to the
+ * 'hash' of the next entry; the first entry's hash is 0. 'block' is a
+ * logical block in the directory: a leaf, or below a root with
+ * 'levels' = 1, another index block. Entries with the same name hash
+ * are always in the same leaf.
+ */
+#define FS_DIR_INDEX 1
+
+struct fs_dx_entry {
+    uint32_t hash;
+    uint32_t block;
+};
+
+struct fs_dx_node {
+    uint32_t count;             /* entries in use */
+    uint32_t levels;            /* root only: index levels below root */
+    struct fs_dx_entry entries[FS_BLOCK_SIZE / sizeof(struct fs_dx_entry) - 1];
+};
+
+enum {DX_ENTRIES = FS_BLOCK_SIZE / sizeof(struct fs_dx_entry) - 1};
+
 #endif
 
 
@@ -26,6 +26,11 @@
 
 extern int homework_part;       /* set by '-part n' command-line option */
 
+/* size of the buffer cache in blocks; 0 runs without it */
+#ifndef CACHE_BLKS
+#define CACHE_BLKS 1024
+#endif
+
 /*
  * disk access - the global variable 'disk' points to a blkdev
  * structure which has been initialized to access the image file.
@@ -45,6 +50,140 @@ fd_set *block_map;
 struct fs_super super_blk;
 struct fs_inode *inodes;
 
+/* the bitmaps and inodes are kept in memory as one copy of disk
+ * blocks 1 to meta_blks. Changes to them are recorded per block, and
+ * only the changed blocks are written at the end of each operation.
+ */
+static char *metadata;
+static int meta_blks;
+static char *meta_dirty;        /* per block, 1 if on dirty_list */
+static int *dirty_list;
+static int n_dirty;
+
+/* free-space search for the two bitmaps. Each map is scanned as
+ * 64-bit words, and a summary bitmap has a bit set for every word
+ * with no free bits left. All words below 'cursor' are full, so a
+ * search starts there and still finds the lowest free bit. The
+ * summaries are kept up to date by inodeMapDirty() and
+ * blockMapDirty(), which are called for every change to the maps.
+ * Blocks in 'resv' (see reservation windows below) count as in use.
+ */
+struct freeMap {
+    uint64_t *words;            /* the bitmap itself */
+    int       nbits;            /* inodes or blocks it covers */
+    int       nwords;
+    uint64_t *full;             /* summary, one bit per word */
+    int       cursor;           /* first word that may not be full */
+    uint64_t *resv;             /* reserved bits, or NULL */
+};
+static struct freeMap inodeFree, blockFree;
+
+// bits of word w that are in the map
+static uint64_t mapValid(struct freeMap *m, int w)
+{
+    int n = m->nbits - w * 64;
+    return (n >= 64) ? ~0ULL : (1ULL << n) - 1;
+}
+
+// recompute the summary bit for the word holding 'bit'
+static void mapUpdate(struct freeMap *m, int bit)
+{
+    int w = bit / 64;
+    uint64_t used = m->words[w] | (m->resv ? m->resv[w] : 0);
+
+    if ((used | ~mapValid(m, w)) == ~0ULL) {
+        m->full[w / 64] |= 1ULL << (w % 64);
+    } else {
+        m->full[w / 64] &= ~(1ULL << (w % 64));
+        if (w < m->cursor) {
+            m->cursor = w;
+        }
+    }
+}
+
+// set up the summary for 'map'; returns -ENOMEM if it can't be allocated
+static int mapInit(struct freeMap *m, fd_set *map, int nbits, int reserve)
+{
+    int w, nsum;
+
+    m->words = (uint64_t*) map;
+    m->nbits = nbits;
+    m->nwords = (nbits + 63) / 64;
+    nsum = (m->nwords + 63) / 64;
+    m->full = malloc(nsum * sizeof(uint64_t));
+    m->resv = reserve ? calloc(m->nwords, sizeof(uint64_t)) : NULL;
+    if (m->full == NULL || (reserve && m->resv == NULL)) {
+        free(m->full);
+        free(m->resv);
+        m->full = m->resv = NULL;
+        return -ENOMEM;
+    }
+    memset(m->full, 0xff, nsum * sizeof(uint64_t));     // words past the end
+    m->cursor = m->nwords;
+    for (w = 0; w < m->nwords; w++) {
+        mapUpdate(m, w * 64);
+    }
+    return 0;
+}
+
+// lowest free bit in the map, or -ENOSPC
+static int mapFind(struct freeMap *m)
+{
+    int s, w;
+
+    for (s = m->cursor / 64; s < (m->nwords + 63) / 64; s++) {
+        if (~m->full[s]) {
+            w = s * 64 + __builtin_ctzll(~m->full[s]);
+            m->cursor = w;
+            return w * 64 + __builtin_ctzll(~(m->words[w] | (m->resv ? m->resv[w] : 0))
+                                            & mapValid(m, w));
+        }
+    }
+    m->cursor = m->nwords;
+    return -ENOSPC;
+}
+
+// number of bits not in use, reserved ones included, counting no
+// further than 'want'
+static int mapCount(struct freeMap *m, int want)
+{
+    int w, n = 0;
+
+    for (w = 0; w < m->nwords && n < want; w++) {
+        n += __builtin_popcountll(~m->words[w] & mapValid(m, w));
+    }
+    return n;
+}
+
+static void markDirty(void *p)
+{
+    int i = ((char*)p - metadata) / FS_BLOCK_SIZE;
+    if (!meta_dirty[i]) {
+        meta_dirty[i] = 1;
+        dirty_list[n_dirty++] = i;
+    }
+}
+
+// inode 'inum' changed
+static void inodeDirty(int inum)
+{
+    markDirty(&inodes[inum]);
+}
+
+// bit for inode 'inum' changed in the inode map
+static void inodeMapDirty(int inum)
+{
+    markDirty((char*)inode_map + inum / 8);
+    mapUpdate(&inodeFree, inum);
+}
+
+// bit for block 'blk' changed in the block map
+static void blockMapDirty(int blk)
+{
+    markDirty((char*)block_map + blk / 8);
+    mapUpdate(&blockFree, blk);
+}
+
 /* init - this is called once by the FUSE framework at startup. Ignore
  * the 'conn' argument.
  * recommended actions:
@@ -53,100 +192,579 @@ struct fs_inode *inodes;
  */
 void* fs_init(struct fuse_conn_info *conn)
 {
+    /* all block access goes through a write-back buffer cache,
+     * flushed at the end of each operation that changes the disk.
+     */
+    if (CACHE_BLKS > 0 && (disk = cache_create(disk, CACHE_BLKS)) == NULL)
+        exit(1);
 
     if (disk->ops->read(disk, 0, 1, &super_blk) < 0)
         exit(1);
 
     /* your code here */
 
-    inode_map = (fd_set*) malloc(super_blk.inode_map_sz * FS_BLOCK_SIZE);
-    block_map = (fd_set*) malloc(super_blk.block_map_sz * FS_BLOCK_SIZE);
-    inodes = (struct fs_inode*) malloc(super_blk.inode_region_sz * FS_BLOCK_SIZE);
-
-    // inode_map = (void*)disk + FS_BLOCK_SIZE;
-    // block_map = (void*)inode_map + sb.inode_map_sz * FS_BLOCK_SIZE;
-    // inodes = (void*)block_map + sb.block_map_sz * FS_BLOCK_SIZE;
-
-    // read inode_map
-    if (disk->ops->read(disk, 1, super_blk.inode_map_sz, inode_map) < 0) {
+    meta_blks = super_blk.inode_map_sz + super_blk.block_map_sz + super_blk.inode_region_sz;
+    metadata = malloc(meta_blks * FS_BLOCK_SIZE);
+    meta_dirty = calloc(meta_blks, 1);
+    dirty_list = malloc(meta_blks * sizeof(int));
+    if (metadata == NULL || meta_dirty == NULL || dirty_list == NULL) {
         exit(1);
     }
 
-    // read block_map
-    if (disk->ops->read(disk, 1 + super_blk.inode_map_sz, super_blk.block_map_sz, block_map) < 0) {
+    inode_map = (fd_set*) metadata;
+    block_map = (fd_set*) (metadata + super_blk.inode_map_sz * FS_BLOCK_SIZE);
+    inodes = (struct fs_inode*) ((char*)block_map + super_blk.block_map_sz * FS_BLOCK_SIZE);
+
+    // read inode_map, block_map and inodes
+    if (disk->ops->read(disk, 1, meta_blks, metadata) < 0) {
         exit(1);
     }
 
-    // read inodes
-    if (disk->ops->read(disk, 1 + super_blk.inode_map_sz + super_blk.block_map_sz, super_blk.inode_region_sz, inodes) < 0) {
+    // only as many inodes as the inode region holds, and blocks as the disk
+    int ninodes = super_blk.inode_region_sz * INODES_PER_BLK;
+    int nblocks = super_blk.num_blocks;
+    if (ninodes > super_blk.inode_map_sz * 8 * FS_BLOCK_SIZE) {
+        ninodes = super_blk.inode_map_sz * 8 * FS_BLOCK_SIZE;
+    }
+    if (nblocks > super_blk.block_map_sz * 8 * FS_BLOCK_SIZE) {
+        nblocks = super_blk.block_map_sz * 8 * FS_BLOCK_SIZE;
+    }
+    if (mapInit(&inodeFree, inode_map, ninodes, 0) < 0 ||
+        mapInit(&blockFree, block_map, nblocks, 1) < 0) {
         exit(1);
     }
 
     return NULL;
 }
 
-static void writeEverythingtoDisk()
+static int cmpInt(const void *a, const void *b)
+{
+    return *(int*)a - *(int*)b;
+}
+
+// write back blocks left dirty in the buffer cache
+static void flushDisk()
 {
-    // write inode_map
-    if (disk->ops->write(disk, 1, super_blk.inode_map_sz, inode_map) < 0) {
+    if (disk->ops->flush(disk, 0, disk->ops->num_blocks(disk)) < 0) {
         exit(1);
     }
+}
+
+// write changed metadata blocks, in runs of consecutive blocks
+static void writeMetadata()
+{
+    int i, j;
+
+    qsort(dirty_list, n_dirty, sizeof(int), cmpInt);
+    for (i = 0; i < n_dirty; i = j) {
+        for (j = i + 1; j < n_dirty && dirty_list[j] == dirty_list[j-1] + 1; j++)
+            ;
+        if (disk->ops->write(disk, 1 + dirty_list[i], j - i, metadata + dirty_list[i] * FS_BLOCK_SIZE) < 0) {
+            exit(1);
+        }
+    }
+    for (i = 0; i < n_dirty; i++) {
+        meta_dirty[dirty_list[i]] = 0;
+    }
+    n_dirty = 0;
+
+    flushDisk();
+}
+
+// Translate Function
+
+#define DIRENTS_PER_BLK (FS_BLOCK_SIZE / sizeof(struct fs_dirent))
+#define NAME_LEN 28             /* size of fs_dirent.name */
+
+/* dentry cache - maps (directory inode, name) to the inode of that
+ * entry, or to -ENOENT if there is no such entry, so that repeated
+ * lookups need no disk reads. It is direct-mapped: a new entry
+ * replaces whatever was in its slot. Operations that add or remove
+ * directory entries keep it up to date through dcacheSet().
+ */
+#define DCACHE_SIZE 1024
+
+struct dentry {
+    int  parent;                /* 0 if slot unused */
+    int  inum;
+    char name[NAME_LEN];
+};
+static struct dentry dcache[DCACHE_SIZE];
+
+// FNV-1a hash of a name
+static unsigned nameHash(const char *name)
+{
+    unsigned h = 2166136261u;
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    return h;
+}
+
+static struct dentry *dcacheSlot(int parent, const char *name)
+{
+    return &dcache[(nameHash(name) ^ (parent * 2654435761u)) % DCACHE_SIZE];
+}
+
+// return 1 and set *inum if (parent, name) is cached
+static int dcacheGet(int parent, const char *name, int *inum)
+{
+    struct dentry *d = dcacheSlot(parent, name);
+    if (d->parent == parent && strcmp(d->name, name) == 0) {
+        *inum = d->inum;
+        return 1;
+    }
+    return 0;
+}
+
+// record that 'name' in directory 'parent' is 'inum' or -ENOENT
+static void dcacheSet(int parent, const char *name, int inum)
+{
+    struct dentry *d = dcacheSlot(parent, name);
+    if (strlen(name) >= NAME_LEN) {
+        return;
+    }
+    d->parent = parent;
+    d->inum = inum;
+    strcpy(d->name, name);
+}
+
+// forget all entries in directory 'parent', which is being removed
+static void dcachePurge(int parent)
+{
+    int i;
+    for (i = 0; i < DCACHE_SIZE; i++) {
+        if (dcache[i].parent == parent) {
+            dcache[i].parent = 0;
+        }
+    }
+}
+
+/* Directories - a directory is a single block of entries until it
+ * fills, and is then indexed by name hash (see fsx600.h). A lookup or
+ * insert reads at most the index root, one index block and one leaf.
+ */
+static int logical2Physical(int inum, int n, int allo);
 
-    // write block_map
-    if (disk->ops->write(disk, 1 + super_blk.inode_map_sz, super_blk.block_map_sz, block_map) < 0) {
+static void readBlock(int blk, void *buf)
+{
+    if (disk->ops->read(disk, blk, 1, buf) < 0) {
         exit(1);
     }
+}
 
-    // write inodes
-    if (disk->ops->write(disk, 1 + super_blk.inode_map_sz + super_blk.block_map_sz, super_blk.inode_region_sz, inodes) < 0) {
+static void writeBlock(int blk, void *buf)
+{
+    if (disk->ops->write(disk, blk, 1, buf) < 0) {
         exit(1);
     }
 }
 
-// Translate Function
+// read or write logical block 'n' of directory 'inum'
+static void readDirBlock(int inum, int n, void *buf)
+{
+    readBlock(logical2Physical(inum, n, 0), buf);
+}
 
-const char *delim = "/";
+static void writeDirBlock(int inum, int n, void *buf)
+{
+    writeBlock(logical2Physical(inum, n, 0), buf);
+}
 
-static int translate(const char *_path)
+// add a zeroed block to indexed directory 'inum', return its logical number
+static int dirGrow(int inum)
 {
-    int inum = 1; // root inode
-    int k, j;
-    int length = 0;
-    const char *token[64];
-    char *p = NULL;
+    char zero[FS_BLOCK_SIZE];
+    int n = inodes[inum].size / FS_BLOCK_SIZE;
+    int blk = logical2Physical(inum, n, 1);
 
-    if (strcmp(_path, "/") == 0) {
-        return inum;
+    if (blk <= 0) {
+        return -ENOSPC;
     }
+    inodes[inum].size += FS_BLOCK_SIZE;
+    inodeDirty(inum);
+    memset(zero, 0, FS_BLOCK_SIZE);
+    writeBlock(blk, zero);
+    return n;
+}
 
-    char *path = strdupa(_path);
-    p = strtok(path, delim);
+// an index block on the path from the root to a leaf
+struct dxFrame {
+    int lblk;                   /* logical block in the directory */
+    int pos;                    /* entry followed */
+    struct fs_dx_node node;
+};
 
-    while (p) {
-        token[length++] = p;
-        p = strtok(0, delim);
+// the last entry of 'node' with hash <= h
+static int dxSearch(struct fs_dx_node *node, unsigned h)
+{
+    int lo = 0, hi = node->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (node->entries[mid].hash <= h) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
     }
-    struct fs_dirent *de =  (struct fs_dirent*) malloc(FS_BLOCK_SIZE);
+    return lo;
+}
 
-    for(j = 0; j < length; j++) {
-        bzero(de, FS_BLOCK_SIZE);
-        if (!S_ISDIR(inodes[inum].mode)) return -ENOTDIR;
-        if (disk->ops->read(disk, inodes[inum].direct[0], 1, de) < 0) {
-            exit(1);
+// insert an entry in hash order
+static void dxPut(struct fs_dx_node *node, unsigned h, int lblk)
+{
+    int i;
+    for (i = node->count; i > 0 && node->entries[i-1].hash > h; i--) {
+        node->entries[i] = node->entries[i-1];
+    }
+    node->entries[i].hash = h;
+    node->entries[i].block = lblk;
+    node->count++;
+}
+
+// move the upper half of the entries of 'node' to 'upper'
+static void dxHalve(struct fs_dx_node *node, struct fs_dx_node *upper)
+{
+    int half = node->count / 2;
+    memset(upper, 0, sizeof(*upper));
+    upper->count = node->count - half;
+    memcpy(upper->entries, node->entries + half, upper->count * sizeof(struct fs_dx_entry));
+    node->count = half;
+}
+
+// read the index path of directory 'inum' for hash 'h' into 'frames'
+// and return its length; the last frame's entry is the leaf
+static int dxWalk(int inum, unsigned h, struct dxFrame *frames)
+{
+    int n = 0, lblk = 0, levels = 0;
+    do {
+        struct dxFrame *f = &frames[n];
+        f->lblk = lblk;
+        readDirBlock(inum, lblk, &f->node);
+        if (n == 0) {
+            levels = (f->node.levels > 0) ? 1 : 0;
+        }
+        f->pos = dxSearch(&f->node, h);
+        lblk = f->node.entries[f->pos].block;
+    } while (n++ < levels);
+    return n;
+}
+
+// read the leaf of directory 'inum' that holds or would hold 'name'
+// into 'de' and return its logical block. For an indexed directory
+// the index path is left in 'frames', and its length in *depth.
+static int dirLeaf(int inum, const char *name, struct fs_dirent *de,
+                   struct dxFrame *frames, int *depth)
+{
+    int lblk = 0;
+    *depth = 0;
+    if (inodes[inum].flags & FS_DIR_INDEX) {
+        *depth = dxWalk(inum, nameHash(name), frames);
+        lblk = frames[*depth-1].node.entries[frames[*depth-1].pos].block;
+    }
+    readDirBlock(inum, lblk, de);
+    return lblk;
+}
+
+static int leafFind(struct fs_dirent *de, const char *name)
+{
+    int k;
+    for (k = 0; k < DIRENTS_PER_BLK; k++) {
+        if (de[k].valid && strcmp(de[k].name, name) == 0) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static int leafFree(struct fs_dirent *de)
+{
+    int k;
+    for (k = 0; k < DIRENTS_PER_BLK; k++) {
+        if (!de[k].valid) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// look up 'name' in directory 'inum' on disk
+static int dirLookup(int inum, const char *name)
+{
+    struct fs_dirent de[DIRENTS_PER_BLK];
+    struct dxFrame frames[2];
+    int depth;
+
+    dirLeaf(inum, name, de, frames, &depth);
+    int k = leafFind(de, name);
+    return (k < 0) ? -ENOENT : de[k].inode;
+}
+
+// make single-block directory 'inum', with entries 'de', indexed
+static int dxCreate(int inum, struct fs_dirent *de)
+{
+    struct fs_dx_node root;
+
+    inodes[inum].size = FS_BLOCK_SIZE;
+    int leaf = dirGrow(inum);
+    if (leaf < 0) {
+        inodes[inum].size = 0;
+        return leaf;
+    }
+    writeDirBlock(inum, leaf, de);
+
+    memset(&root, 0, sizeof(root));
+    root.count = 1;
+    root.entries[0].hash = 0;
+    root.entries[0].block = leaf;
+    writeDirBlock(inum, 0, &root);
+
+    inodes[inum].flags |= FS_DIR_INDEX;
+    inodeDirty(inum);
+    return 0;
+}
+
+// add index entry (h, lblk) for a new leaf to the last node on the
+// path, splitting that node with the new blocks in 'spare' if full
+static void dxInsert(int inum, struct dxFrame *frames, int depth,
+                     unsigned h, int lblk, int *spare)
+{
+    struct dxFrame *f = &frames[depth-1];
+    struct fs_dx_node upper;
+
+    if (f->node.count < DX_ENTRIES) {
+        dxPut(&f->node, h, lblk);
+        writeDirBlock(inum, f->lblk, &f->node);
+        return;
+    }
+
+    dxHalve(&f->node, &upper);
+    dxPut((h >= upper.entries[0].hash) ? &upper : &f->node, h, lblk);
+
+    if (depth == 2) {
+        // new sibling under the root
+        writeDirBlock(inum, f->lblk, &f->node);
+        writeDirBlock(inum, spare[0], &upper);
+        dxPut(&frames[0].node, upper.entries[0].hash, spare[0]);
+        writeDirBlock(inum, 0, &frames[0].node);
+    } else {
+        // root entries move down into two new index blocks
+        f->node.levels = 0;
+        writeDirBlock(inum, spare[0], &f->node);
+        writeDirBlock(inum, spare[1], &upper);
+        f->node.count = 0;
+        f->node.levels = 1;
+        dxPut(&f->node, 0, spare[0]);
+        dxPut(&f->node, upper.entries[0].hash, spare[1]);
+        writeDirBlock(inum, 0, &f->node);
+    }
+}
+
+struct hashedDirent {
+    unsigned hash;
+    struct fs_dirent de;
+};
+
+static int cmpHash(const void *a, const void *b)
+{
+    unsigned x = ((struct hashedDirent*)a)->hash;
+    unsigned y = ((struct hashedDirent*)b)->hash;
+    return (x > y) - (x < y);
+}
+
+// split the full leaf 'lblk' of directory 'inum', held in 'de', in
+// two by hash. Leaves the half that 'name' belongs in in 'de' and
+// returns its logical block.
+static int dxSplit(int inum, const char *name, int lblk, struct fs_dirent *de,
+                   struct dxFrame *frames, int depth)
+{
+    struct hashedDirent e[DIRENTS_PER_BLK];
+    struct fs_dirent upper[DIRENTS_PER_BLK];
+    int i, m, spare[3], need = 1;
+
+    for (i = 0; i < DIRENTS_PER_BLK; i++) {
+        e[i].hash = nameHash(de[i].name);
+        e[i].de = de[i];
+    }
+    qsort(e, DIRENTS_PER_BLK, sizeof(e[0]), cmpHash);
+
+    // split near the middle, keeping equal hashes together
+    for (m = DIRENTS_PER_BLK / 2; m < DIRENTS_PER_BLK && e[m].hash == e[m-1].hash; m++)
+        ;
+    if (m == DIRENTS_PER_BLK) {
+        for (m = DIRENTS_PER_BLK / 2; m > 0 && e[m].hash == e[m-1].hash; m--)
+            ;
+    }
+    if (m == 0) {
+        return -ENOSPC;
+    }
+
+    // blocks for the new leaf and for index nodes split on the way up
+    if (frames[depth-1].node.count == DX_ENTRIES) {
+        if (depth == 2 && frames[0].node.count == DX_ENTRIES) {
+            return -ENOSPC;
         }
-        for (k = 0; k <= 31; k++) {
-            if (de[k].valid && (strcmp(de[k].name, token[j]) == 0)) {
-                inum = de[k].inode;
-                break;
+        need += (depth == 1) ? 2 : 1;
+    }
+    // each new block may also need up to two blocks to map it, and
+    // dirGrow can't be undone, so check before growing
+    if (mapCount(&blockFree, 3 * need) < 3 * need) {
+        return -ENOSPC;
+    }
+    for (i = 0; i < need; i++) {
+        if ((spare[i] = dirGrow(inum)) < 0) {
+            return -ENOSPC;
+        }
+    }
+
+    memset(de, 0, FS_BLOCK_SIZE);
+    memset(upper, 0, FS_BLOCK_SIZE);
+    for (i = 0; i < DIRENTS_PER_BLK; i++) {
+        if (i < m) {
+            de[i] = e[i].de;
+        } else {
+            upper[i - m] = e[i].de;
+        }
+    }
+    writeDirBlock(inum, lblk, de);
+    writeDirBlock(inum, spare[0], upper);
+    dxInsert(inum, frames, depth, e[m].hash, spare[0], spare + 1);
+
+    if (nameHash(name) >= e[m].hash) {
+        memcpy(de, upper, FS_BLOCK_SIZE);
+        return spare[0];
+    }
+    return lblk;
+}
+
+// add entry 'name' for inode 'child' to directory 'inum'
+static int dirAdd(int inum, const char *name, int child, int isDir)
+{
+    struct fs_dirent de[DIRENTS_PER_BLK];
+    struct dxFrame frames[2];
+    int depth, k;
+
+    if (strlen(name) >= NAME_LEN) {
+        return -ENAMETOOLONG;
+    }
+
+    int lblk = dirLeaf(inum, name, de, frames, &depth);
+    if ((k = leafFree(de)) < 0) {
+        if (depth == 0) {
+            if (dxCreate(inum, de) < 0) {
+                return -ENOSPC;
             }
-            if (k == 31) {
-                inum = -ENOENT;
-                break;
+            lblk = dirLeaf(inum, name, de, frames, &depth);
+        }
+        if ((lblk = dxSplit(inum, name, lblk, de, frames, depth)) < 0) {
+            return lblk;
+        }
+        k = leafFree(de);
+    }
+
+    de[k].valid = 1;
+    de[k].isDir = isDir;
+    de[k].inode = child;
+    strcpy(de[k].name, name);
+    writeDirBlock(inum, lblk, de);
+    dcacheSet(inum, name, child);
+    return 0;
+}
+
+// remove entry 'name' from directory 'inum', return its inode or -ENOENT
+static int dirRemove(int inum, const char *name)
+{
+    struct fs_dirent de[DIRENTS_PER_BLK];
+    struct dxFrame frames[2];
+    int depth;
+
+    int lblk = dirLeaf(inum, name, de, frames, &depth);
+    int k = leafFind(de, name);
+    if (k < 0) {
+        return -ENOENT;
+    }
+    de[k].valid = 0;
+    writeDirBlock(inum, lblk, de);
+    dcacheSet(inum, name, -ENOENT);
+    return de[k].inode;
+}
+
+// call 'fn' for the entries below logical block 'lblk', an index
+// block with 'levels' levels below it or a leaf if levels < 0
+static int dirIterateBlock(int inum, int lblk, int levels,
+                           int (*fn)(struct fs_dirent *, void *), void *arg)
+{
+    int i, val;
+
+    if (levels < 0) {
+        struct fs_dirent de[DIRENTS_PER_BLK];
+        readDirBlock(inum, lblk, de);
+        for (i = 0; i < DIRENTS_PER_BLK; i++) {
+            if (de[i].valid && (val = fn(&de[i], arg)) != 0) {
+                return val;
             }
         }
+        return 0;
+    }
+
+    struct fs_dx_node node;
+    readDirBlock(inum, lblk, &node);
+    for (i = 0; i < node.count; i++) {
+        if ((val = dirIterateBlock(inum, node.entries[i].block, levels - 1, fn, arg)) != 0) {
+            return val;
+        }
+    }
+    return 0;
+}
+
+// call 'fn' for each entry of directory 'inum' until it returns nonzero
+static int dirIterate(int inum, int (*fn)(struct fs_dirent *, void *), void *arg)
+{
+    int levels = -1;
+    if (inodes[inum].flags & FS_DIR_INDEX) {
+        struct fs_dx_node root;
+        readDirBlock(inum, 0, &root);
+        levels = (root.levels > 0) ? 1 : 0;
+    }
+    return dirIterateBlock(inum, 0, levels, fn, arg);
+}
+
+static int translate(const char *path)
+{
+    int inum = 1; // root inode
+    char name[NAME_LEN];
+    const char *p = path, *q;
+
+    while (1) {
+        while (*p == '/') {
+            p++;
+        }
+        if (*p == 0) {
+            return inum;
+        }
+        q = strchrnul(p, '/');
+        if (!S_ISDIR(inodes[inum].mode)) {
+            return -ENOTDIR;
+        }
+        if (q - p >= NAME_LEN) {
+            return -ENOENT;
+        }
+        memcpy(name, p, q - p);
+        name[q - p] = 0;
+
+        int next;
+        if (!dcacheGet(inum, name, &next)) {
+            next = dirLookup(inum, name);
+            dcacheSet(inum, name, next);
+        }
+        if (next < 0) {
+            // a missing component with more path after it is reported
+            // as not a directory
+            return (q[strspn(q, "/")] != 0) ? -ENOTDIR : next;
+        }
+        inum = next;
+        p = q;
     }
-    free(de);
-    return inum;
 }
 
 /* Note on path translation errors:
@@ -222,33 +840,32 @@ static int fs_getattr(const char *path, struct stat *sb)
  *
  * Errors - path resolution, ENOTDIR, ENOENT
  */
-static int fs_readdir(const char *path, void *ptr, fuse_fill_dir_t filler,
-   off_t offset, struct fuse_file_info *fi)
+struct readdirArgs {
+    int inum;
+    void *ptr;
+    fuse_fill_dir_t filler;
+};
+
+static int readdirEntry(struct fs_dirent *de, void *arg)
 {
-    int i = 0;
+    struct readdirArgs *a = arg;
     struct stat sb;
 
+    fill_stat(a->inum, inodes[de->inode], &sb);
+    return a->filler(a->ptr, de->name, &sb, 0);
+}
+
+static int fs_readdir(const char *path, void *ptr, fuse_fill_dir_t filler,
+   off_t offset, struct fuse_file_info *fi)
+{
     int inum = translate(path);
     if (inum < 0) {
         return inum;
     }
     if (!S_ISDIR(inodes[inum].mode)) return -ENOTDIR;
 
-    // struct fs_inode _inode = inodes[inum];
-    struct fs_dirent *de =  (struct fs_dirent*) malloc(FS_BLOCK_SIZE);
-    if (disk->ops->read(disk, inodes[inum].direct[0], 1, de) < 0) {
-        exit(1);
-    }
-    // sb = (struct stat*) malloc(sizeof(struct stat));
-
-    for (; i <=31; i++) {
-        if (!de[i].valid) {
-            continue;
-        }
-        fill_stat(inum, inodes[de[i].inode], &sb);
-        filler(ptr, de[i].name, &sb, 0);
-    }
-    free(de);
+    struct readdirArgs a = {inum, ptr, filler};
+    dirIterate(inum, readdirEntry, &a);
     return 0;
 }
 
@@ -267,24 +884,135 @@ static int fs_releasedir(const char *path, struct fuse_file_info *fi)
 
 static int getFreeInodeIndex()
 {
-    int i;
-    for (i = 0; i < super_blk.inode_map_sz * FS_BLOCK_SIZE; i++) {
-        if (!FD_ISSET(i, inode_map)) {
-            return i;
+    return mapFind(&inodeFree);
+}
+
+static void dropWindows();
+
+static int getFreeBlockIndex()
+{
+    int blk = mapFind(&blockFree);
+
+    // when only reserved blocks are left, give up the reservations
+    if (blk < 0) {
+        dropWindows();
+        blk = mapFind(&blockFree);
+    }
+    return blk;
+}
+
+/* reservation windows - a regular file being written takes its blocks
+ * from a window of free blocks reserved just after its last block, so
+ * that files written at the same time do not interleave their blocks.
+ * Other allocations skip reserved blocks until nothing else is free.
+ * The first window is ALLOC_WINDOW blocks and each later one twice the
+ * last, up to ALLOC_WINDOW_MAX. Windows are kept only in memory and are
+ * given back by fs_release, fs_truncate and fs_unlink. With ALLOC_WINDOW 0 a file's next block
+ * still goes right after its last one when that block is free.
+ */
+#ifndef ALLOC_WINDOW
+#define ALLOC_WINDOW 8
+#endif
+#define ALLOC_WINDOW_MAX 256
+
+struct window {
+    int inum;
+    int start;                  /* reserved blocks start..end-1 */
+    int end;
+    int size;                   /* of the last window */
+    struct window *next;
+};
+static struct window *windows;
+
+static void reserveBlock(int blk, int on)
+{
+    if (on) {
+        blockFree.resv[blk / 64] |= 1ULL << (blk % 64);
+    } else {
+        blockFree.resv[blk / 64] &= ~(1ULL << (blk % 64));
+    }
+    mapUpdate(&blockFree, blk);
+}
+
+// block exists and is neither in use nor reserved
+static int blockAvail(int blk)
+{
+    return blk > 0 && blk < blockFree.nbits && !FD_ISSET(blk, block_map) &&
+        !(blockFree.resv[blk / 64] & (1ULL << (blk % 64)));
+}
+
+static void dropWindow(struct window *w)
+{
+    for (; w->start < w->end; w->start++) {
+        reserveBlock(w->start, 0);
+    }
+}
+
+static void dropWindows()
+{
+    struct window *w;
+    for (w = windows; w != NULL; w = w->next) {
+        dropWindow(w);
+    }
+}
+
+static void releaseWindow(int inum)
+{
+    struct window **pp, *w;
+
+    for (pp = &windows; (w = *pp) != NULL; pp = &w->next) {
+        if (w->inum == inum) {
+            dropWindow(w);
+            *pp = w->next;
+            free(w);
+            return;
         }
     }
-    return -ENOSPC;
 }
 
-static int getFreeBlockIndex()
+/* a free block for logical block n of 'inum', which is about to be
+ * allocated; n-1 is already mapped. Like getFreeBlockIndex the caller
+ * marks it in use.
+ */
+static int getFileBlockIndex(int inum, int n)
 {
-    int i;
-    for (i = 0; i < super_blk.block_map_sz * FS_BLOCK_SIZE; i++) {
-        if (!FD_ISSET(i, block_map)) {
-            return i;
+    struct window *w;
+    int blk, goal = 0;
+
+    for (w = windows; w != NULL && w->inum != inum; w = w->next)
+        ;
+    if (w != NULL && w->start < w->end) {
+        reserveBlock(w->start, 0);
+        return w->start++;
+    }
+
+    if (n > 0) {
+        goal = logical2Physical(inum, n - 1, 0) + 1;
+    }
+    blk = blockAvail(goal) ? goal : getFreeBlockIndex();
+    if (blk < 0 || ALLOC_WINDOW == 0 || !S_ISREG(inodes[inum].mode)) {
+        return blk;
+    }
+
+    if (w == NULL) {
+        if ((w = malloc(sizeof(*w))) == NULL) {
+            return blk;             // just go without a window
         }
+        w->inum = inum;
+        w->size = 0;
+        w->next = windows;
+        windows = w;
     }
-    return -ENOSPC;
+    if (w->size == 0) {
+        w->size = ALLOC_WINDOW;
+    } else if (w->size < ALLOC_WINDOW_MAX) {
+        w->size *= 2;
+    }
+    w->start = w->end = blk + 1;
+    while (w->end < blk + w->size && blockAvail(w->end)) {
+        reserveBlock(w->end++, 1);
+    }
+    return blk;
 }
 
 static void resolvePath(const char*_path, char dname[], char base[])
@@ -310,19 +1038,16 @@ static int addEntity(const char *path, mode_t mode, int isDir)
     // check and return Error codes
     // if dirname doesnt exist
     // if base isn't a directory
-    // Go through all directory entries for *dname* and check if *base* exists
-    // Find invalid index in drectory that can be used
-    // Modify directory entry for *base* with new values
-    // and write to disk
+    // Check if *base* exists in *dname*, then add an entry for it
     //
-    int index;
     char base[1024];
     char dname[1024];
+    char zero[FS_BLOCK_SIZE];
+    int err;
 
     resolvePath(path, dname, base);
 
     int inumDir = translate(dname);
-    int inumBase = translate(base);
 
     if (inumDir < 0) {
         return -ENOENT;
@@ -330,28 +1055,8 @@ static int addEntity(const char *path, mode_t mode, int isDir)
         return -ENOTDIR;
     }
 
-    struct fs_dirent *de =  (struct fs_dirent*) malloc(FS_BLOCK_SIZE);
-    if (disk->ops->read(disk, inodes[inumDir].direct[0], 1, de) < 0) {
-        exit(1);
-    }
-
-    for (index = 0; index <= 31; index++) {
-        if (de[index].valid) {
-            if (strcmp(de[index].name, base) == 0) {
-                free(de);
-                return -EEXIST;
-            }
-        } 
-    }
-
-    for (index = 0; index <= 31; index++) {
-        if (de[index].valid == 0) {
-            break;
-        }
-        if (index == 31) {
-            free(de);
-            return -ENOSPC;
-        }
+    if (translate(path) >= 0) {
+        return -EEXIST;
     }
 
     int freeInodeIndex = getFreeInodeIndex();
@@ -361,36 +1066,44 @@ static int addEntity(const char *path, mode_t mode, int isDir)
         return -ENOSPC;
     }
 
+    // the directory may grow, using up the free block
+    if ((err = dirAdd(inumDir, base, freeInodeIndex, isDir)) < 0) {
+        writeMetadata();
+        return err;
+    }
+    if (isDir && (freeBlockIndex = getFreeBlockIndex()) < 0) {
+        dirRemove(inumDir, base);
+        writeMetadata();
+        return -ENOSPC;
+    }
+
     FD_SET(freeInodeIndex, inode_map);
+    inodeMapDirty(freeInodeIndex);
+    inodeDirty(freeInodeIndex);
 
     struct fs_inode *_inode = &inodes[freeInodeIndex];
     struct fuse_context *ctx = fuse_get_context();
 
+    memset(_inode, 0, sizeof(*_inode));
     _inode->uid = ctx->uid;
     _inode->gid = ctx->gid;
     _inode->mode =  mode;
     _inode->ctime = time(NULL);
     _inode->mtime = _inode->ctime;
     _inode->size = 0;
+    if (!isDir && EXTENT_FILES) {
+        _inode->flags = FS_EXTENTS;
+    }
     
     if (isDir) {
         FD_SET(freeBlockIndex, block_map);
+        blockMapDirty(freeBlockIndex);
         _inode->direct[0] = freeBlockIndex; 
+        memset(zero, 0, FS_BLOCK_SIZE);
+        writeBlock(freeBlockIndex, zero);
     }
 
-    de[index].valid = 1;
-    de[index].isDir = isDir;
-    de[index].inode = freeInodeIndex;
-    strcpy(de[index].name, base);
-
-    // write directory
-    if (disk->ops->write(disk, inodes[inumDir].direct[0], 1, de) < 0) {
-        exit(1);
-    }
-
-    writeEverythingtoDisk();
-
-    free(de);
+    writeMetadata();
 
     return 0;
 }
@@ -429,6 +1142,276 @@ static int fs_mkdir(const char *path, mode_t mode)
     // return -EOPNOTSUPP;
 }
 
+/* extent-mapped files - see fsx600.h. New regular files are created
+ * with FS_EXTENTS if EXTENT_FILES is 1; existing files keep whatever
+ * mapping they were created with. A file's extents stay in
+ * the inode until they no longer fit, then move to a tree of at most
+ * two levels. The last extent looked up is remembered, so a sequential
+ * pass over a file reads no mapping blocks at all once it is found.
+ */
+#ifndef EXTENT_FILES
+#define EXTENT_FILES 0
+#endif
+
+static struct {
+    int inum;                   /* 0 if none */
+    struct fs_extent ext;
+} lastExtent;
+
+// is logical block n in extent e
+static int extentHas(struct fs_extent *e, int n)
+{
+    return n >= e->lblk && n < e->lblk + e->len;
+}
+
+// index of the last of 'count' sorted entries starting at or before n, or -1
+static int extSearch(struct fs_extent *e, int count, int n)
+{
+    int lo = 0, hi = count;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (e[mid].lblk <= n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+// mark block 'blk' (from getFreeBlockIndex etc.) in use
+static int allocBlock(int blk)
+{
+    if (blk < 0) {
+        return -ENOSPC;
+    }
+    FD_SET(blk, block_map);
+    blockMapDirty(blk);
+    return blk;
+}
+
+static void freeBlock(int blk)
+{
+    FD_CLR(blk, block_map);
+    blockMapDirty(blk);
+}
+
+/* read the leaf holding the extents around logical block n. Returns
+ * its block, or 0 for the extents in the inode (copied into 'leaf').
+ * With an index root, 'root' and *pos give the index entry for it.
+ */
+static int extLeaf(int inum, int n, struct fs_ext_node *root, int *pos,
+                   struct fs_ext_node *leaf)
+{
+    struct fs_inode *in = &inodes[inum];
+
+    if (!in->ext_tree) {
+        memset(leaf, 0, sizeof(*leaf));
+        leaf->count = in->n_extents;
+        memcpy(leaf->entries, in->extents, sizeof(in->extents));
+        return 0;
+    }
+    if (in->ext_depth == 0) {
+        readBlock(in->ext_tree, leaf);
+        return in->ext_tree;
+    }
+    readBlock(in->ext_tree, root);
+    *pos = extSearch(root->entries, root->count, n);
+    if (*pos < 0) {
+        *pos = 0;
+    }
+    readBlock(root->entries[*pos].pblk, leaf);
+    return root->entries[*pos].pblk;
+}
+
+static void extPutLeaf(int inum, int blk, struct fs_ext_node *leaf)
+{
+    if (blk) {
+        writeBlock(blk, leaf);
+        return;
+    }
+    inodes[inum].n_extents = leaf->count;
+    memcpy(inodes[inum].extents, leaf->entries, sizeof(inodes[inum].extents));
+    inodeDirty(inum);
+}
+
+/* insert extent x at entries[at] of the leaf read by extLeaf, moving
+ * the extents out of the inode or splitting the leaf if it is full.
+ */
+static int extInsert(int inum, int blk, struct fs_ext_node *root, int pos,
+                     struct fs_ext_node *leaf, int at, struct fs_extent *x)
+{
+    struct fs_inode *in = &inodes[inum];
+    struct fs_ext_node upper;
+    int i, b, half;
+
+    if (leaf->count < (blk ? EXT_ENTRIES : N_EXTENTS)) {
+        memmove(&leaf->entries[at + 1], &leaf->entries[at],
+                (leaf->count - at) * sizeof(struct fs_extent));
+        leaf->entries[at] = *x;
+        leaf->count++;
+        extPutLeaf(inum, blk, leaf);
+        return 0;
+    }
+
+    // the inode is full - its extents become the root leaf of a tree
+    if (blk == 0) {
+        if ((b = allocBlock(getFreeBlockIndex())) < 0) {
+            return -ENOSPC;
+        }
+        in->ext_tree = b;
+        in->ext_depth = 0;
+        in->n_extents = 0;
+        memset(in->extents, 0, sizeof(in->extents));
+        inodeDirty(inum);
+        return extInsert(inum, b, root, pos, leaf, at, x);
+    }
+
+    // a full root leaf moves down a level, below a new index root
+    if (in->ext_depth == 0) {
+        if ((b = allocBlock(getFreeBlockIndex())) < 0) {
+            return -ENOSPC;
+        }
+        writeBlock(b, leaf);
+        memset(root, 0, sizeof(*root));
+        root->count = 1;
+        root->entries[0].pblk = b;
+        writeBlock(in->ext_tree, root);
+        in->ext_depth = 1;
+        inodeDirty(inum);
+        blk = b;
+        pos = 0;
+    }
+
+    if (root->count == EXT_ENTRIES || (b = allocBlock(getFreeBlockIndex())) < 0) {
+        return -ENOSPC;
+    }
+
+    /* appending starts an empty leaf, so files written sequentially
+     * keep their leaves full; otherwise split the leaf in half.
+     */
+    memset(&upper, 0, sizeof(upper));
+    half = (at == leaf->count) ? at : leaf->count / 2;
+    upper.count = leaf->count - half;
+    memcpy(upper.entries, &leaf->entries[half], upper.count * sizeof(struct fs_extent));
+    leaf->count = half;
+    if (at < half) {
+        memmove(&leaf->entries[at + 1], &leaf->entries[at],
+                (leaf->count - at) * sizeof(struct fs_extent));
+        leaf->entries[at] = *x;
+        leaf->count++;
+    } else {
+        at -= half;
+        memmove(&upper.entries[at + 1], &upper.entries[at],
+                (upper.count - at) * sizeof(struct fs_extent));
+        upper.entries[at] = *x;
+        upper.count++;
+    }
+    writeBlock(blk, leaf);
+    writeBlock(b, &upper);
+
+    for (i = root->count; i > pos + 1; i--) {
+        root->entries[i] = root->entries[i - 1];
+    }
+    root->entries[pos + 1] = (struct fs_extent) {upper.entries[0].lblk, b, 0};
+    root->count++;
+    writeBlock(in->ext_tree, root);
+    return 0;
+}
+
+/* logical2Physical for extent-mapped files. A new block extends the
+ * preceding extent when it follows it on disk.
+ */
+static int extentMap(int inum, int n, int allo)
+{
+    struct fs_ext_node root, leaf;
+    struct fs_extent *e, x;
+    int pos = 0, blk, i, p;
+
+    if (lastExtent.inum == inum && extentHas(&lastExtent.ext, n)) {
+        return lastExtent.ext.pblk + n - lastExtent.ext.lblk;
+    }
+
+    blk = extLeaf(inum, n, &root, &pos, &leaf);
+    i = extSearch(leaf.entries, leaf.count, n);
+    e = (i >= 0) ? &leaf.entries[i] : NULL;
+    if (e && extentHas(e, n)) {
+        lastExtent.inum = inum;
+        lastExtent.ext = *e;
+        return e->pblk + n - e->lblk;
+    }
+    if (!allo) {
+        return 0;
+    }
+
+    if ((p = allocBlock(getFileBlockIndex(inum, n))) < 0) {
+        return -ENOSPC;
+    }
+    if (e && e->lblk + e->len == n && e->pblk + e->len == p) {
+        e->len++;
+        extPutLeaf(inum, blk, &leaf);
+        return p;
+    }
+    x = (struct fs_extent) {n, p, 1};
+    if (extInsert(inum, blk, &root, pos, &leaf, i + 1, &x) < 0) {
+        freeBlock(p);
+        return -ENOSPC;
+    }
+    return p;
+}
+
+// free the blocks of 'count' extents, zeroing them like removeAllData
+static void freeExtents(struct fs_extent *e, int count)
+{
+    static char zero[64 * FS_BLOCK_SIZE];
+    int i, j, n;
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < e[i].len; j += n) {
+            n = (e[i].len - j < 64) ? e[i].len - j : 64;
+            if (disk->ops->write(disk, e[i].pblk + j, n, zero) < 0) {
+                exit(1);
+            }
+        }
+        for (j = 0; j < e[i].len; j++) {
+            freeBlock(e[i].pblk + j);
+        }
+    }
+}
+
+static struct fs_inode removeExtents(struct fs_inode _inode)
+{
+    struct fs_ext_node root, leaf;
+    struct fs_extent node;
+    int i;
+
+    if (!_inode.ext_tree) {
+        freeExtents(_inode.extents, _inode.n_extents);
+    } else {
+        readBlock(_inode.ext_tree, &root);
+        if (_inode.ext_depth == 0) {
+            freeExtents(root.entries, root.count);
+        } else {
+            for (i = 0; i < root.count; i++) {
+                readBlock(root.entries[i].pblk, &leaf);
+                freeExtents(leaf.entries, leaf.count);
+                node = (struct fs_extent) {0, root.entries[i].pblk, 1};
+                freeExtents(&node, 1);
+            }
+        }
+        node = (struct fs_extent) {0, _inode.ext_tree, 1};
+        freeExtents(&node, 1);
+    }
+
+    memset(_inode.extents, 0, sizeof(_inode.extents));
+    _inode.n_extents = 0;
+    _inode.ext_depth = 0;
+    _inode.ext_tree = 0;
+    lastExtent.inum = 0;
+    return _inode;
+}
+
 static struct fs_inode removeAllData(struct fs_inode _inode)
 {
     int dir;
@@ -439,6 +1422,10 @@ static struct fs_inode removeAllData(struct fs_inode _inode)
     int *double_indirect2;
     int *block;
 
+    if (_inode.flags & FS_EXTENTS) {
+        return removeExtents(_inode);
+    }
+
     for(dir = 0; dir<6; dir++) {
         if (_inode.direct[dir]) {
             block = malloc(FS_BLOCK_SIZE);
@@ -450,6 +1437,7 @@ static struct fs_inode removeAllData(struct fs_inode _inode)
                 exit(1);
             }
             FD_CLR(_inode.direct[dir], block_map);
+            blockMapDirty(_inode.direct[dir]);
             _inode.direct[dir] = 0;
             free(block);
         }
@@ -472,6 +1460,7 @@ static struct fs_inode removeAllData(struct fs_inode _inode)
                 }
 
                 FD_CLR(indirect1[k], block_map);
+                blockMapDirty(indirect1[k]);
                 indirect1[k] = 0;
                 free(block);
             }
@@ -481,6 +1470,7 @@ static struct fs_inode removeAllData(struct fs_inode _inode)
         }
 
         FD_CLR(_inode.indir_1, block_map);
+        blockMapDirty(_inode.indir_1);
         _inode.indir_1 = 0;
         free(indirect1);
     }
@@ -509,6 +1499,7 @@ static struct fs_inode removeAllData(struct fs_inode _inode)
                         }
 
                         FD_CLR(double_indirect2[i], block_map);
+                        blockMapDirty(double_indirect2[i]);
                         double_indirect2[i] = 0;
                         free(block);
                     }
@@ -517,6 +1508,7 @@ static struct fs_inode removeAllData(struct fs_inode _inode)
                     exit(1);
                 }
                 FD_CLR(indirect2[k], block_map);
+                blockMapDirty(indirect2[k]);
                 indirect2[k] = 0;
                 free(double_indirect2);
             }
@@ -526,6 +1518,7 @@ static struct fs_inode removeAllData(struct fs_inode _inode)
         }
 
         FD_CLR(_inode.indir_2, block_map);
+        blockMapDirty(_inode.indir_2);
         _inode.indir_2 = 0;
         free(indirect2);
     }
@@ -544,7 +1537,6 @@ static int fs_truncate(const char *path, off_t len)
      */
     if (len != 0) return -EINVAL;		/* invalid argument */
 
-    int index;
     char base[1024];
     char dname[1024];
 
@@ -558,34 +1550,18 @@ static int fs_truncate(const char *path, off_t len)
         return -EISDIR;
     }
 
-    struct fs_dirent *de =  (struct fs_dirent*) malloc(FS_BLOCK_SIZE);
-    if (disk->ops->read(disk, inodes[inumDir].direct[0], 1, de) < 0) {
-        exit(1);
-    }
-
-    for (index = 0; index<=31; index++) {
-        if(de[index].valid && strcmp(de[index].name, base) == 0) {
-
-            // trucate
-            inodes[de[index].inode].size = 0;
-            inodes[de[index].inode].mtime = time(NULL);
-
-            struct fs_inode _inode = inodes[de[index].inode];
-            inodes[de[index].inode] = removeAllData(_inode);
-            break;
-        }
-    }
+    // trucate
+    inodes[inum].size = 0;
+    inodes[inum].mtime = time(NULL);
+    releaseWindow(inum);
+    inodes[inum] = removeAllData(inodes[inum]);
+    inodeDirty(inum);
 
     inodes[inumDir].mtime = time(NULL);
+    inodeDirty(inumDir);
 
-    // write directory
-    if (disk->ops->write(disk, inodes[inumDir].direct[0], 1, de) < 0) {
-        exit(1);
-    }
-
-    writeEverythingtoDisk();
+    writeMetadata();
 
-    free(de);
     return 0;
     // return -EOPNOTSUPP;
 }
@@ -596,8 +1572,6 @@ static int fs_truncate(const char *path, off_t len)
  */
 static int fs_unlink(const char *path)
 {
-    int index;
-    int dir;
     char base[1024];
     char dname[1024];
 
@@ -611,54 +1585,34 @@ static int fs_unlink(const char *path)
         return -EISDIR;
     }
 
-    struct fs_dirent *de =  (struct fs_dirent*) malloc(FS_BLOCK_SIZE);
-    if (disk->ops->read(disk, inodes[inumDir].direct[0], 1, de) < 0) {
-        exit(1);
-    }
-
-    for (index = 0; index<=31; index++) {
-        if(de[index].valid && strcmp(de[index].name, base) == 0) {
+    // unlink
+    dirRemove(inumDir, base);
+    FD_CLR(inum, inode_map);
+    inodeMapDirty(inum);
 
-            // unlink
-            de[index].valid = 0;
-            FD_CLR(de[index].inode, inode_map);
-
-            struct fs_inode _inode = inodes[de[index].inode];
-            inodes[de[index].inode] = removeAllData(_inode);
-            break;
-        }
-    }
+    // an open file's window would outlive it and pass to the next
+    // file given this inode
+    releaseWindow(inum);
+    inodes[inum] = removeAllData(inodes[inum]);
+    inodeDirty(inum);
 
     inodes[inumDir].mtime = time(NULL);
+    inodeDirty(inumDir);
 
-    // write directory
-    if (disk->ops->write(disk, inodes[inumDir].direct[0], 1, de) < 0) {
-        exit(1);
-    }
-
-    writeEverythingtoDisk();
+    writeMetadata();
 
-    free(de);
     return 0;
     // return -EOPNOTSUPP;
 }
 
-static int isDirEmpty(int inum)
+static int anyEntry(struct fs_dirent *de, void *arg)
 {
-    int index;
-    int result = 1;
-    struct fs_dirent *de =  (struct fs_dirent*) malloc(FS_BLOCK_SIZE);
-    if (disk->ops->read(disk, inodes[inum].direct[0], 1, de) < 0) {
-        exit(1);
-    }
+    return 1;
+}
 
-    for (index = 0; index <= 31; index++) {
-        if (de[index].valid) {
-            result = 0;
-        } 
-    }
-    free(de);
-    return result;
+static int isDirEmpty(int inum)
+{
+    return !dirIterate(inum, anyEntry, NULL);
 }
 
 /* rmdir - remove a directory
@@ -666,7 +1620,6 @@ static int isDirEmpty(int inum)
  */
 static int fs_rmdir(const char *path)
 {
-    int index;
     char base[1024];
     char dname[1024];
 
@@ -682,30 +1635,22 @@ static int fs_rmdir(const char *path)
         return -ENOTEMPTY;
     }
 
-    struct fs_dirent *de =  (struct fs_dirent*) malloc(FS_BLOCK_SIZE);
-    if (disk->ops->read(disk, inodes[inumDir].direct[0], 1, de) < 0) {
-        exit(1);
-    }
+    dirRemove(inumDir, base);
+    FD_CLR(inum, inode_map);
+    inodeMapDirty(inum);
+    dcachePurge(inum);
 
-    for (index = 0; index <= 31; index++) {
-        if (de[index].valid && (strcmp(de[index].name, base) == 0)) {
-            de[index].valid = 0;
-            FD_CLR(de[index].inode, inode_map);
-            break;
-        } 
-    }
-    
     inodes[inumDir].mtime = time(NULL);
-    FD_CLR(inodes[inum].direct[0], block_map);
+    inodeDirty(inumDir);
 
-    // write directory
-    if (disk->ops->write(disk, inodes[inumDir].direct[0], 1, de) < 0) {
-        exit(1);
-    }
+    // free the directory's blocks
+    inodes[inum] = removeAllData(inodes[inum]);
+    inodes[inum].size = 0;
+    inodes[inum].flags = 0;
+    inodeDirty(inum);
 
-    writeEverythingtoDisk();
+    writeMetadata();
 
-    free(de);
     return 0;
     // return -EOPNOTSUPP;
 }
@@ -724,11 +1669,11 @@ static int fs_rmdir(const char *path)
  */
 static int fs_rename(const char *src_path, const char *dst_path)
 {
-    int index;
     char direct_dst[1024];
     char direct_src[1024];
     char base_dst[1024];
     char base_src[1024];
+    int err;
 
     int inumSrc = translate(src_path);
     int inumDst = translate(dst_path);
@@ -747,34 +1692,20 @@ static int fs_rename(const char *src_path, const char *dst_path)
         return -EINVAL;
     }
 
+    // the new name may hash to a different leaf, so add it and then
+    // remove the old one; if the add fails the old entry is untouched
     int parentSrc = translate(direct_src);
-    struct fs_dirent *de =  (struct fs_dirent*) malloc(FS_BLOCK_SIZE);
-    if (disk->ops->read(disk, inodes[parentSrc].direct[0], 1, de) < 0) {
-        exit(1);
-    }
-
-    for (index = 0; index <= 31; index++) {
-        if (de[index].valid) {
-            if (strcmp(de[index].name, base_src) == 0) {
-                strcpy(de[index].name, base_dst);
-                break;
-            }
-        } 
+    int isDir = S_ISDIR(inodes[inumSrc].mode);
+    if ((err = dirAdd(parentSrc, base_dst, inumSrc, isDir)) < 0) {
+        writeMetadata();
+        return err;
     }
+    dirRemove(parentSrc, base_src);
 
     inodes[inumSrc].mtime = time(NULL);
+    inodeDirty(inumSrc);
 
-    // write directory
-    if (disk->ops->write(disk, inodes[parentSrc].direct[0], 1, de) < 0) {
-        exit(1);
-    }
-
-    // write inodes
-    if (disk->ops->write(disk, 1 + super_blk.inode_map_sz + super_blk.block_map_sz, super_blk.inode_region_sz, inodes) < 0) {
-        exit(1);
-    }
-
-    free(de);
+    writeMetadata();
 
     return 0;
 
@@ -796,10 +1727,8 @@ static int fs_chmod(const char *path, mode_t mode)
     }
 
     inodes[inum].mode = S_ISDIR(mode) ? (mode | S_IFDIR) :  (mode | S_IFREG);
-
-    if (disk->ops->write(disk, 1 + super_blk.inode_map_sz + super_blk.block_map_sz, super_blk.inode_region_sz, inodes) < 0) {
-        exit(1);
-    }
+    inodeDirty(inum);
+    writeMetadata();
 
     return 0;
 }
@@ -813,10 +1742,8 @@ int fs_utime(const char *path, struct utimbuf *ut)
     }
 
     inodes[inum].mtime = ut->modtime;
-
-    if (disk->ops->write(disk, 1 + super_blk.inode_map_sz + super_blk.block_map_sz, super_blk.inode_region_sz, inodes) < 0) {
-        exit(1);
-    }
+    inodeDirty(inum);
+    writeMetadata();
 
     return 0;
 }
@@ -861,17 +1788,23 @@ static int logical2Physical(int inum, int n, int allo)
 {
     int result = 0;
     int i;
+    int lblk = n;               // n is made relative to each range below
+
+    if (inodes[inum].flags & FS_EXTENTS) {
+        return extentMap(inum, n, allo);
+    }
 
     struct fs_inode _inode = inodes[inum];
     if (n < 6) {
 
         result = _inode.direct[n];
         if (allo && !result) {
-            result = getFreeBlockIndex();
+            result = getFileBlockIndex(inum, lblk);
             if (result < 0) return -ENOSPC;
             _inode.direct[n] = result;
+            inodeDirty(inum);
             FD_SET(result, block_map);
-            disk->ops->write(disk, 1 + super_blk.inode_map_sz, super_blk.block_map_sz, block_map);
+            blockMapDirty(result);
         }
         inodes[inum] = _inode;
         return result;
@@ -890,11 +1823,12 @@ static int logical2Physical(int inum, int n, int allo)
             free(indirect1);
         } else {
             if (!_inode.indir_1) {
-                int index = getFreeBlockIndex();
-                if (result < 0) return -ENOSPC;
+                int index = getFileBlockIndex(inum, lblk);
+                if (index < 0) return -ENOSPC;
                 _inode.indir_1 = index;
+                inodeDirty(inum);
                 FD_SET(index, block_map);
-                disk->ops->write(disk, 1 + super_blk.inode_map_sz, super_blk.block_map_sz, block_map);
+                blockMapDirty(index);
 
             }
 
@@ -905,15 +1839,14 @@ static int logical2Physical(int inum, int n, int allo)
 
             result = indirect1[n];
             if (!result) {
-                result = getFreeBlockIndex();
+                result = getFileBlockIndex(inum, lblk);
                 if (result < 0) return -ENOSPC;
                 indirect1[n] = result;
                 FD_SET(result, block_map);
-                disk->ops->write(disk, 1 + super_blk.inode_map_sz, super_blk.block_map_sz, block_map);
-            }
-
-            if (disk->ops->write(disk, _inode.indir_1, 1, indirect1) < 0) {
-                exit(1);
+                blockMapDirty(result);
+                if (disk->ops->write(disk, _inode.indir_1, 1, indirect1) < 0) {
+                    exit(1);
+                }
             }
             free(indirect1);
         }
@@ -940,11 +1873,12 @@ static int logical2Physical(int inum, int n, int allo)
 
     } else {
         if (!_inode.indir_2) {
-            int index = getFreeBlockIndex();
-            if (result < 0) return -ENOSPC;
+            int index = getFileBlockIndex(inum, lblk);
+            if (index < 0) return -ENOSPC;
             _inode.indir_2 = index;
+            inodeDirty(inum);
             FD_SET(index, block_map);
-            disk->ops->write(disk, 1 + super_blk.inode_map_sz, super_blk.block_map_sz, block_map);
+            blockMapDirty(index);
         }
         int *indirect2 = malloc(sizeof(int) * 256);
         if (disk->ops->read(disk, _inode.indir_2, 1, indirect2) < 0) {
@@ -952,15 +1886,14 @@ static int logical2Physical(int inum, int n, int allo)
         }
 
         if (!indirect2[n/256]) {
-            int index = getFreeBlockIndex();
-            if (result < 0) return -ENOSPC;
+            int index = getFileBlockIndex(inum, lblk);
+            if (index < 0) return -ENOSPC;
             indirect2[n/256] = index;
             FD_SET(index, block_map);
-            disk->ops->write(disk, 1 + super_blk.inode_map_sz, super_blk.block_map_sz, block_map);
-        }
-
-        if (disk->ops->write(disk, _inode.indir_2, 1, indirect2) < 0) {
-            exit(1);
+            blockMapDirty(index);
+            if (disk->ops->write(disk, _inode.indir_2, 1, indirect2) < 0) {
+                exit(1);
+            }
         }
 
         int *double_indirect2 = malloc(sizeof(int) * 256);
@@ -970,15 +1903,14 @@ static int logical2Physical(int inum, int n, int allo)
 
         result = double_indirect2[n%256];
         if (!result) {
-            result = getFreeBlockIndex();
+            result = getFileBlockIndex(inum, lblk);
             if (result < 0) return -ENOSPC;
             double_indirect2[n%256] = result;
             FD_SET(result, block_map);
-            disk->ops->write(disk, 1 + super_blk.inode_map_sz, super_blk.block_map_sz, block_map);
-        }
-
-        if (disk->ops->write(disk, indirect2[n/256], 1, double_indirect2) < 0) {
-            exit(1);
+            blockMapDirty(result);
+            if (disk->ops->write(disk, indirect2[n/256], 1, double_indirect2) < 0) {
+                exit(1);
+            }
         }
 
         inodes[inum] = _inode;
@@ -1030,12 +1962,12 @@ static int logical2Physical(int inum, int n, int allo)
 static int fs_read(const char *path, char *buf, size_t len, off_t offset,
   struct fuse_file_info *fi)
 {
-    int index;
     int i;
     int inum;
-    int bytesToRead = (int) len;
-    int bytes_Read = 0;
+    int bytesToRead;
+    int nblks;
     int total = len;
+    char tempBuffer[FS_BLOCK_SIZE];
 
     inum = translate(path);
 
@@ -1059,27 +1991,31 @@ static int fs_read(const char *path, char *buf, size_t len, off_t offset,
 
         if (!blk_number) return -EINVAL;
 
-        char *tempBuffer = (char*) malloc(FS_BLOCK_SIZE);
-        bzero(tempBuffer, FS_BLOCK_SIZE);
-        
-        if (disk->ops->read(disk, blk_number, 1, tempBuffer)) {
-            exit(1);
-        }
-        
-        bytesToRead = ( (blk_offset + 1) * FS_BLOCK_SIZE ) - offset;
         i = offset % FS_BLOCK_SIZE;
-        if (bytesToRead > total) {
-            bytesToRead = total;
+        if (i != 0 || total < FS_BLOCK_SIZE) {
+            // part of a block, through a temporary buffer
+            if (disk->ops->read(disk, blk_number, 1, tempBuffer) < 0) {
+                exit(1);
+            }
+            bytesToRead = FS_BLOCK_SIZE - i;
+            if (bytesToRead > total) {
+                bytesToRead = total;
+            }
+            memcpy(buf + counter, tempBuffer + i, bytesToRead);
+        } else {
+            // whole blocks straight into buf, as many as follow each other on disk
+            for (nblks = 1; (nblks + 1) * FS_BLOCK_SIZE <= total &&
+                     logical2Physical(inum, blk_offset + nblks, 0) == blk_number + nblks; nblks++)
+                ;
+            if (disk->ops->read(disk, blk_number, nblks, buf + counter) < 0) {
+                exit(1);
+            }
+            bytesToRead = nblks * FS_BLOCK_SIZE;
         }
 
-        // strncpy( buf , tempBuffer + i, bytesToRead);
-        memcpy(buf + counter, tempBuffer + i, bytesToRead);
-
-        // buf += bytesToRead;
         counter += bytesToRead;
         offset += bytesToRead;
         total -= bytesToRead;
-        free(tempBuffer);
     }
 
     return counter;
@@ -1100,10 +2036,10 @@ static int fs_write(const char *path, const char *buf, size_t len,
     int blk;
     int i;
     int counter;
-
+    int nblks;
     int bytes_to_write = 0;
     int total = len;
-    int iOffset = 0;
+    char tempBuffer[FS_BLOCK_SIZE];
 
     inum = translate(path);
     
@@ -1123,41 +2059,51 @@ static int fs_write(const char *path, const char *buf, size_t len,
         int blk_offset = offset/FS_BLOCK_SIZE;
         blk = logical2Physical(inum, blk_offset, 1);
 
-        if (blk == 0) return -EINVAL;
-        if (blk < 0) return -ENOSPC;
-
-        char *tempBuffer = malloc(FS_BLOCK_SIZE) ;
-        if (disk->ops->read(disk, blk, 1, tempBuffer) < 0) {
-            exit(1);
+        if (blk <= 0) {
+            writeMetadata();
+            return (blk == 0) ? -EINVAL : -ENOSPC;
         }
 
-        bytes_to_write = ( (blk_offset + 1) * FS_BLOCK_SIZE ) - offset;
         i = offset % FS_BLOCK_SIZE;
-        if (bytes_to_write > total) {
-            bytes_to_write = total;
-        }
-        // memset(TEMP + iOffset, buf[offset] , bytes_to_write);
-        // strncpy(TEMP, buf + offset, bytes_to_write);
-        // for (i = iOffset; i < iOffset + bytes_to_write; ++i)
-        // {
-        //     tempBuffer[i] = buf[bytesWritten++];
-        // }
-        memcpy(tempBuffer + i, buf + counter, bytes_to_write);
-
-        if (disk->ops->write(disk, blk, 1, tempBuffer) < 0) {
-            exit(1);
+        if (i != 0 || total < FS_BLOCK_SIZE) {
+            bytes_to_write = FS_BLOCK_SIZE - i;
+            if (bytes_to_write > total) {
+                bytes_to_write = total;
+            }
+            // read-modify-write, unless the rest of the block is past EOF
+            if (i == 0 && offset + bytes_to_write >= inodes[inum].size) {
+                memset(tempBuffer, 0, FS_BLOCK_SIZE);
+            } else if (disk->ops->read(disk, blk, 1, tempBuffer) < 0) {
+                exit(1);
+            }
+            memcpy(tempBuffer + i, buf + counter, bytes_to_write);
+            if (disk->ops->write(disk, blk, 1, tempBuffer) < 0) {
+                exit(1);
+            }
+        } else {
+            /* whole blocks are written straight from buf, as many as
+             * follow each other on disk; a block that does not is
+             * left for the next time round.
+             */
+            for (nblks = 1; (nblks + 1) * FS_BLOCK_SIZE <= total &&
+                     logical2Physical(inum, blk_offset + nblks, 1) == blk + nblks; nblks++)
+                ;
+            if (disk->ops->write(disk, blk, nblks, (void*) buf + counter) < 0) {
+                exit(1);
+            }
+            bytes_to_write = nblks * FS_BLOCK_SIZE;
         }
 
-        // bytesWritten+= bytes_to_write;
         offset += bytes_to_write;
         counter += bytes_to_write;
         total-= bytes_to_write;
-        free(tempBuffer);
-        writeEverythingtoDisk();
     }
 
-    inodes[inum].size += counter;
-    writeEverythingtoDisk();
+    if (offset > inodes[inum].size) {
+        inodes[inum].size = offset;
+    }
+    inodeDirty(inum);
+    writeMetadata();
 
     return counter;
     // return -EOPNOTSUPP;
@@ -1170,6 +2116,12 @@ static int fs_open(const char *path, struct fuse_file_info *fi)
 
 static int fs_release(const char *path, struct fuse_file_info *fi)
 {
+    int inum = translate(path);
+
+    // blocks reserved for writing this file are free for others again
+    if (inum > 0) {
+        releaseWindow(inum);
+    }
     return 0;
 }
 
@@ -6,17 +6,23 @@
  */
 
 #define _XOPEN_SOURCE 500
+#define _DEFAULT_SOURCE         /* syscall, MAP_POPULATE */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#undef BLOCK_SIZE                /* linux/fs.h defines it too */
 
 #include "blkdev.h"
 
@@ -24,6 +30,8 @@ struct image_dev {
     char *path;
     int   fd;
     int   nblks;
+    char *map;                  /* image_mmap_create only */
+    struct uring *ring;         /* image_uring_create only */
 };
 
 
@@ -98,6 +106,10 @@ void image_close(struct blkdev *dev)
 {
     struct image_dev *im = dev->private;
 
+    if (im->map != NULL) {
+        msync(im->map, (size_t)im->nblks * BLOCK_SIZE, MS_SYNC);
+        munmap(im->map, (size_t)im->nblks * BLOCK_SIZE);
+    }
     if (im->fd != -1)
         close(im->fd);
     free(im);
@@ -145,12 +157,377 @@ struct blkdev *image_create(char *path)
                 path, BLOCK_SIZE);
     
     im->nblks = sb.st_size / BLOCK_SIZE;
+    im->map = NULL;
+    im->ring = NULL;
     dev->private = im;
     dev->ops = &image_ops;
 
     return dev;
 }
 
+/* The same operations for an image mapped into memory, where read
+ * and write are just copies to and from the mapping.
+ */
+static int mmap_read(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct image_dev *im = dev->private;
+
+    if (im->fd == -1)
+        return E_UNAVAIL;
+
+    assert(offset >= 0 && offset+len <= im->nblks);
+
+    memcpy(buf, im->map + (size_t)offset*BLOCK_SIZE, (size_t)len*BLOCK_SIZE);
+    return SUCCESS;
+}
+
+static int mmap_write(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct image_dev *im = dev->private;
+
+    if (offset == 0)
+        printf("ERROR? write to sector 0\n");
+
+    if (im->fd == -1)
+        return E_UNAVAIL;
+
+    assert(offset >= 0 && offset+len <= im->nblks);
+
+    memcpy(im->map + (size_t)offset*BLOCK_SIZE, buf, (size_t)len*BLOCK_SIZE);
+    return SUCCESS;
+}
+
+/* start write-back of the pages holding the range (msync wants the
+ * start rounded down to a page). Like image_flush this does not wait
+ * for the disk - with MS_SYNC every file system operation would.
+ * image_close does wait.
+ */
+static int mmap_flush(struct blkdev *dev, int offset, int len)
+{
+    struct image_dev *im = dev->private;
+
+    if (im->fd == -1)
+        return E_UNAVAIL;
+
+    size_t start = (size_t)offset*BLOCK_SIZE;
+    size_t pg = start % sysconf(_SC_PAGESIZE);
+    if (msync(im->map + start - pg, (size_t)len*BLOCK_SIZE + pg, MS_ASYNC) < 0) {
+        fprintf(stderr, "msync error on %s: %s\n", im->path, strerror(errno));
+        assert(0);
+    }
+    return SUCCESS;
+}
+
+struct blkdev_ops image_mmap_ops = {
+    .num_blocks = image_num_blocks,
+    .read = mmap_read,
+    .write = mmap_write,
+    .flush = mmap_flush,
+    .close = image_close
+};
+
+/* create an image blkdev with the whole image file mapped MAP_SHARED,
+ * so block reads and writes cost no system calls; changes reach the
+ * file when flushed or closed.
+ */
+struct blkdev *image_mmap_create(char *path)
+{
+    struct blkdev *dev = image_create(path);
+
+    if (dev == NULL)
+        return NULL;
+
+    struct image_dev *im = dev->private;
+    im->map = mmap(NULL, (size_t)im->nblks * BLOCK_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, im->fd, 0);
+    if (im->map == MAP_FAILED) {
+        fprintf(stderr, "can't map image %s: %s\n", path, strerror(errno));
+        im->map = NULL;
+        image_close(dev);
+        return NULL;
+    }
+    dev->ops = &image_mmap_ops;
+
+    return dev;
+}
+
+/* The operations for an image accessed through an io_uring, which
+ * can have up to 'depth' requests in flight. There is no liburing
+ * here, just the io_uring_setup and io_uring_enter system calls and
+ * the submission and completion rings they share with the kernel.
+ * Every request is passed to the kernel as soon as it is submitted,
+ * so the submission ring never holds more than one entry.
+ */
+struct uring {
+    int       fd;
+    int       depth;            /* submission ring entries */
+    int       inflight;         /* submitted and not yet completed */
+    void     *sq_ring, *cq_ring;
+    size_t    sq_sz, cq_sz;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+};
+
+/* complete at least 'min' requests, calling their 'done' functions,
+ * along with any others that have already finished.
+ */
+static int uring_wait(struct blkdev *dev, int min)
+{
+    struct image_dev *im = dev->private;
+    struct uring *r = im->ring;
+    int n = 0;
+
+    if (min > r->inflight)
+        min = r->inflight;
+    for (;;) {
+        unsigned head = *r->cq_head;
+        if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            if (n >= min)
+                break;
+            if (syscall(__NR_io_uring_enter, r->fd, 0, min - n,
+                        IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+                fprintf(stderr, "io_uring error on %s: %s\n", im->path, strerror(errno));
+                assert(0);
+            }
+            continue;
+        }
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        struct blkdev_req *req = (void*)(uintptr_t)cqe->user_data;
+        int result = cqe->res;
+        __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+        r->inflight--;
+        n++;
+
+        /* as with image_read and image_write, errors are fatal */
+        char *op = (req->op == BLKDEV_READ) ? "read" : "write";
+        if (result < 0) {
+            fprintf(stderr, "%s error on %s: %s\n", op, im->path, strerror(-result));
+            assert(0);
+        }
+        if (result != req->num_blks*BLOCK_SIZE) {
+            fprintf(stderr, "short %s on %s\n", op, im->path);
+            assert(0);
+        }
+        req->result = SUCCESS;
+        if (req->done != NULL)
+            req->done(req);
+    }
+    return n;
+}
+
+static int uring_submit(struct blkdev *dev, struct blkdev_req *req)
+{
+    struct image_dev *im = dev->private;
+    struct uring *r = im->ring;
+
+    if (req->op == BLKDEV_WRITE && req->first_blk == 0)
+        printf("ERROR? write to sector 0\n");
+
+    if (im->fd == -1)
+        return E_UNAVAIL;
+
+    assert(req->first_blk >= 0 && req->first_blk+req->num_blks <= im->nblks);
+
+    /* keep the completion ring from overflowing */
+    if (r->inflight == r->depth)
+        uring_wait(dev, 1);
+
+    unsigned tail = *r->sq_tail, i = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (req->op == BLKDEV_READ) ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = im->fd;
+    sqe->addr = (uintptr_t)req->buf;
+    sqe->len = req->num_blks * BLOCK_SIZE;
+    sqe->off = (off_t)req->first_blk * BLOCK_SIZE;
+    sqe->user_data = (uintptr_t)req;
+    r->sq_array[i] = i;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->inflight++;
+
+    if (syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0) != 1) {
+        fprintf(stderr, "io_uring error on %s: %s\n", im->path, strerror(errno));
+        assert(0);
+    }
+    return SUCCESS;
+}
+
+/* synchronous requests are not ordered with the ones in flight, so
+ * they wait for those to finish and then use pread and pwrite.
+ */
+static int uring_read(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct image_dev *im = dev->private;
+    uring_wait(dev, im->ring->inflight);
+    return image_read(dev, offset, len, buf);
+}
+
+static int uring_write(struct blkdev *dev, int offset, int len, void *buf)
+{
+    struct image_dev *im = dev->private;
+    uring_wait(dev, im->ring->inflight);
+    return image_write(dev, offset, len, buf);
+}
+
+static int uring_flush(struct blkdev *dev, int offset, int len)
+{
+    struct image_dev *im = dev->private;
+    uring_wait(dev, im->ring->inflight);
+    return image_flush(dev, offset, len);
+}
+
+static void uring_free(struct uring *r)
+{
+    if (r->sqes != NULL)
+        munmap(r->sqes, r->depth * sizeof(*r->sqes));
+    if (r->cq_ring != NULL && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_sz);
+    if (r->sq_ring != NULL)
+        munmap(r->sq_ring, r->sq_sz);
+    if (r->fd != -1)
+        close(r->fd);
+    free(r);
+}
+
+static void uring_close(struct blkdev *dev)
+{
+    struct image_dev *im = dev->private;
+
+    uring_wait(dev, im->ring->inflight);
+    uring_free(im->ring);
+    im->ring = NULL;
+    image_close(dev);
+}
+
+struct blkdev_ops image_uring_ops = {
+    .num_blocks = image_num_blocks,
+    .read = uring_read,
+    .write = uring_write,
+    .flush = uring_flush,
+    .close = uring_close,
+    .submit = uring_submit,
+    .wait = uring_wait
+};
+
+static void *ring_map(int fd, size_t len, off_t offset)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, offset);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/* true if the ring supports IORING_OP_READ and IORING_OP_WRITE,
+ * which arrived in Linux 5.6 along with IORING_REGISTER_PROBE. Older
+ * kernels set up a ring but fail every one of our requests.
+ */
+static int ring_has_rw(int fd)
+{
+    int n = IORING_OP_WRITE + 1, ok;
+    struct io_uring_probe *probe = calloc(1, sizeof(*probe) + n * sizeof(probe->ops[0]));
+
+    if (probe == NULL)
+        return 0;
+    ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, n) == 0 &&
+        probe->ops_len > IORING_OP_WRITE &&
+        (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+        (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+/* create an image blkdev that can keep up to 'depth' requests in
+ * flight through submit and wait. Returns NULL if the kernel does
+ * not provide io_uring with read and write requests.
+ */
+struct blkdev *image_uring_create(char *path, int depth)
+{
+    struct blkdev *dev = image_create(path);
+
+    if (dev == NULL)
+        return NULL;
+
+    struct image_dev *im = dev->private;
+    struct uring *r = calloc(1, sizeof(*r));
+    struct io_uring_params p;
+
+    if (r == NULL) {
+        image_close(dev);
+        return NULL;
+    }
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, depth, &p);
+    if (r->fd < 0) {
+        fprintf(stderr, "can't set up io_uring for %s: %s\n", path, strerror(errno));
+        r->fd = -1;
+        goto fail;
+    }
+    if (!ring_has_rw(r->fd)) {
+        fprintf(stderr, "io_uring for %s has no read/write requests\n", path);
+        goto fail;
+    }
+    r->depth = p.sq_entries;
+
+    /* newer kernels map both rings with one mmap */
+    r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_sz > r->sq_sz)
+            r->sq_sz = r->cq_sz;
+        r->cq_sz = r->sq_sz;
+    }
+    r->sq_ring = ring_map(r->fd, r->sq_sz, IORING_OFF_SQ_RING);
+    if (r->sq_ring != NULL)
+        r->cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->sq_ring :
+            ring_map(r->fd, r->cq_sz, IORING_OFF_CQ_RING);
+    r->sqes = ring_map(r->fd, r->depth * sizeof(*r->sqes), IORING_OFF_SQES);
+    if (r->sq_ring == NULL || r->cq_ring == NULL || r->sqes == NULL) {
+        fprintf(stderr, "can't map io_uring for %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    r->sq_tail = r->sq_ring + p.sq_off.tail;
+    r->sq_mask = r->sq_ring + p.sq_off.ring_mask;
+    r->sq_array = r->sq_ring + p.sq_off.array;
+    r->cq_head = r->cq_ring + p.cq_off.head;
+    r->cq_tail = r->cq_ring + p.cq_off.tail;
+    r->cq_mask = r->cq_ring + p.cq_off.ring_mask;
+    r->cqes = r->cq_ring + p.cq_off.cqes;
+
+    im->ring = r;
+    dev->ops = &image_uring_ops;
+    return dev;
+
+fail:
+    uring_free(r);
+    image_close(dev);
+    return NULL;
+}
+
+/* submit and wait for devices with or without asynchronous support.
+ */
+int blkdev_submit(struct blkdev *dev, struct blkdev_req *req)
+{
+    if (dev->ops->submit != NULL)
+        return dev->ops->submit(dev, req);
+
+    if (req->op == BLKDEV_READ)
+        req->result = dev->ops->read(dev, req->first_blk, req->num_blks, req->buf);
+    else
+        req->result = dev->ops->write(dev, req->first_blk, req->num_blks, req->buf);
+    if (req->done != NULL)
+        req->done(req);
+    return SUCCESS;
+}
+
+int blkdev_wait(struct blkdev *dev, int min)
+{
+    if (dev->ops->wait != NULL)
+        return dev->ops->wait(dev, min);
+    return 0;                   /* nothing is ever outstanding */
+}
+
 /* force an image blkdev into failure. after this any further access
  * to that device will return E_UNAVAIL.
  */
@@ -158,6 +535,11 @@ void image_fail(struct blkdev *dev)
 {
     struct image_dev *im = dev->private;
 
+    if (im->ring != NULL)
+        uring_wait(dev, im->ring->inflight);
+    if (im->map != NULL)
+        munmap(im->map, (size_t)im->nblks * BLOCK_SIZE);
+    im->map = NULL;
     if (im->fd != -1)
         close(im->fd);
     im->fd = -1;
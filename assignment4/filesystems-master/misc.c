@@ -36,6 +36,8 @@ struct data {
     char *image_name;
     int   part;
     int   cmd_mode;
+    int   use_mmap;
+    int   uring_depth;
 } _data;
 int homework_part;
 
@@ -43,15 +45,20 @@ int homework_part;
  * See comments in /usr/include/fuse/fuse_opts.h for details of 
  * FUSE argument processing.
  * 
- *  usage: ./homework -image disk.img [-part #] directory
+ *  usage: ./homework -image disk.img [-part #] [-mmap] [-uring #] directory
  *              disk.img  - name of the image file to mount
  *              directory - directory to mount it on
+ *              -mmap     - access the image through mmap, not read/write
+ *              -uring #  - access the image through an io_uring with
+ *                          up to # requests in flight
  */
 static struct fuse_opt opts[] = {
     {"-image %s", offsetof(struct data, image_name), 0},
     {"-cmdline", offsetof(struct data, cmd_mode), 1},
 
     {"-part %d", offsetof(struct data, part), 0},
+    {"-mmap", offsetof(struct data, use_mmap), 1},
+    {"-uring %d", offsetof(struct data, uring_depth), 0},
     FUSE_OPT_END
 };
 
@@ -131,26 +138,48 @@ int do_pwd(char *argv[])
     return 0;
 }
 
-#define DIRENTS_PER_BLOCK (FS_BLOCK_SIZE / sizeof(struct fs_dirent))
-
-char lsbuf[DIRENTS_PER_BLOCK][64];
-int  lsi;
+/* directories can hold any number of entries, so the listing grows
+ */
+#define LS_WIDTH 128
+char (*lsbuf)[LS_WIDTH];
+int  lsi, lsmax;
 
 void init_ls(void)
 {
     lsi = 0;
 }
 
+/* next line of the listing, or NULL (after reporting it) if the
+ * listing cannot grow; the fillers then return 1 to end readdir
+ */
+static char *ls_next(void)
+{
+    if (lsi == lsmax) {
+	int max = lsmax ? 2*lsmax : 64;
+	char (*buf)[LS_WIDTH] = realloc(lsbuf, max * sizeof(*lsbuf));
+	if (buf == NULL) {
+	    printf("ls: out of memory, listing truncated\n");
+	    return NULL;
+	}
+	lsbuf = buf;
+	lsmax = max;
+    }
+    return lsbuf[lsi++];
+}
+
 static int filler(void *buf, const char *name, const struct stat *sb, off_t off)
 {
-    sprintf(lsbuf[lsi++], "%s\n", name);
+    char *line = ls_next();
+    if (line == NULL)
+	return 1;
+    sprintf(line, "%s\n", name);
     return 0;
 }
 
 void print_ls(void)
 {
     int i;
-    qsort(lsbuf, lsi, 64, (void*)strcmp);
+    qsort(lsbuf, lsi, LS_WIDTH, (void*)strcmp);
     for (i = 0; i < lsi; i++)
 	printf("%s", lsbuf[i]);
 }
@@ -175,8 +204,10 @@ int do_ls1(char *argv[])
 
 static int dashl_filler(void *buf, const char *name, const struct stat *sb, off_t off)
 {
-    char mode[16];
-    sprintf(lsbuf[lsi++], "%s %s %lld %lld %s",
+    char mode[16], *line = ls_next();
+    if (line == NULL)
+	return 1;
+    snprintf(line, LS_WIDTH, "%s %s %lld %lld %s",
             name, strmode(mode, sb->st_mode), sb->st_size, sb->st_blocks,
             ctime(&sb->st_mtime));
     return 0;
@@ -269,6 +300,7 @@ int do_put(char *argv[])
 	    break;
 	offset += len;
     }
+    fs_ops.release(path, NULL);	/* as FUSE does on close */
     close(fd);
     return (val >= 0) ? 0 : val;
 }
@@ -471,7 +503,12 @@ int main(int argc, char **argv)
         printf("bad image file (must end in .img): %s\n", file);
         exit(1);
     }
-    if ((disk = image_create(file)) == NULL) {
+    disk = NULL;
+    if (_data.uring_depth > 0 && (disk = image_uring_create(file, _data.uring_depth)) == NULL)
+        fprintf(stderr, "io_uring unavailable, using read/write\n");
+    if (disk == NULL)
+        disk = _data.use_mmap ? image_mmap_create(file) : image_create(file);
+    if (disk == NULL) {
         printf("cannot open image file '%s': %s\n", file, strerror(errno));
         exit(1);
     }
@@ -16,6 +16,36 @@
 
 #include "fsx600.h"
 
+/* physical block holding logical block 'n' of an inode
+ */
+int file_block(void *disk, struct fs_inode *in, int n)
+{
+    if (n < N_DIRECT)
+        return in->direct[n];
+    n -= N_DIRECT;
+    if (n < 256)
+        return in->indir_1 ? ((int*)(disk + in->indir_1 * FS_BLOCK_SIZE))[n] : 0;
+    n -= 256;
+    if (!in->indir_2)
+        return 0;
+    int i2 = ((int*)(disk + in->indir_2 * FS_BLOCK_SIZE))[n / 256];
+    return i2 ? ((int*)(disk + i2 * FS_BLOCK_SIZE))[n % 256] : 0;
+}
+
+/* print and mark the data blocks of 'count' extents
+ */
+void print_extents(struct fs_extent *e, int count, fd_set *blkmap, fd_set *block_map)
+{
+    int i, b;
+    for (i = 0; i < count; i++)
+        for (b = e[i].pblk; b < e[i].pblk + e[i].len; b++) {
+            printf("%d ", b);
+            FD_SET(b, blkmap);
+            if (!FD_ISSET(b, block_map))
+                printf("\n***ERROR*** block %d marked free\n", b);
+        }
+}
+
 int main(int argc, char **argv)
 {
     int i, j, fd = open(argv[1], O_RDONLY);
@@ -78,6 +108,24 @@ int main(int argc, char **argv)
                    "      size  %d\n",
                    e.inum, in->uid, in->gid, in->mode, in->size);
             printf("blocks: ");
+            if (in->flags & FS_EXTENTS) {
+                if (!in->ext_tree)
+                    print_extents(in->extents, in->n_extents, blkmap, block_map);
+                else {
+                    struct fs_ext_node *root = disk + in->ext_tree * FS_BLOCK_SIZE;
+                    FD_SET(in->ext_tree, blkmap);
+                    if (in->ext_depth == 0)
+                        print_extents(root->entries, root->count, blkmap, block_map);
+                    else
+                        for (i = 0; i < root->count; i++) {
+                            struct fs_ext_node *leaf = disk + root->entries[i].pblk * FS_BLOCK_SIZE;
+                            FD_SET(root->entries[i].pblk, blkmap);
+                            print_extents(leaf->entries, leaf->count, blkmap, block_map);
+                        }
+                }
+                printf("\n\n");
+                continue;
+            }
             for (i = 0; i < 6; i++)
                 if (in->direct[i]) {
                     printf("%d ", in->direct[i]);
@@ -119,30 +167,60 @@ int main(int argc, char **argv)
                 printf("***ERROR*** inode %d not a directory\n", e.inum);
                 continue;
             }
-            printf("directory: inode %d (block %d)\n", e.inum, in->direct[0]);
-            struct fs_dirent *de = disk + in->direct[0] * FS_BLOCK_SIZE;
-            if (!FD_ISSET(in->direct[0], block_map))
-                printf("\n***ERROR*** block %d marked free\n", in->direct[0]);
-            FD_SET(in->direct[0], blkmap);
-            
-            for (i = 0; i < 32; i++)
-                if (de[i].valid) {
-                    printf("  %s %d %s\n", de[i].isDir ? "D" : "F", de[i].inode,
-                           de[i].name);
-                    int j = de[i].inode;
-                    if (j < 0 || j >= sb->inode_region_sz * 16) {
-                        printf("***ERROR*** invalid inode %d\n", j);
+            /* leaves hold the entries; a directory that is not
+             * indexed is a single leaf
+             */
+            int nblks = 1, nleaves = 0, l;
+            if (in->flags & FS_DIR_INDEX) {
+                nblks = in->size / FS_BLOCK_SIZE;
+                printf("directory: inode %d (indexed, %d blocks)\n", e.inum, nblks);
+            }
+            else
+                printf("directory: inode %d (block %d)\n", e.inum, in->direct[0]);
+            int leaves[nblks];
+            for (l = 0; l < nblks; l++) {
+                int b = file_block(disk, in, l);
+                if (!FD_ISSET(b, block_map))
+                    printf("\n***ERROR*** block %d marked free\n", b);
+                FD_SET(b, blkmap);
+            }
+            if (in->flags & FS_DIR_INDEX) {
+                struct fs_dx_node *root = disk + in->direct[0] * FS_BLOCK_SIZE;
+                for (l = 0; l < root->count; l++) {
+                    int b = root->entries[l].block;
+                    if (root->levels == 0) {
+                        leaves[nleaves++] = b;
                         continue;
                     }
-                    if (FD_ISSET(j, imap)) {
-                        printf("***ERROR*** loop found (inode %d)\n", e.inum);
-                        goto fail;
-                    }
-                    FD_SET(j, imap);
-                    if (!FD_ISSET(j, inode_map))
-                        printf("***ERROR*** inode %d is marked free\n", j);
-                    inode_list[head++] = (struct entry) {.dir = de[i].isDir, j};
+                    struct fs_dx_node *node = disk + file_block(disk, in, b) * FS_BLOCK_SIZE;
+                    for (j = 0; j < node->count; j++)
+                        leaves[nleaves++] = node->entries[j].block;
                 }
+            }
+            else
+                leaves[nleaves++] = 0;
+
+            for (l = 0; l < nleaves; l++) {
+                struct fs_dirent *de = disk + file_block(disk, in, leaves[l]) * FS_BLOCK_SIZE;
+                for (i = 0; i < 32; i++)
+                    if (de[i].valid) {
+                        printf("  %s %d %s\n", de[i].isDir ? "D" : "F", de[i].inode,
+                               de[i].name);
+                        int j = de[i].inode;
+                        if (j < 0 || j >= sb->inode_region_sz * 16) {
+                            printf("***ERROR*** invalid inode %d\n", j);
+                            continue;
+                        }
+                        if (FD_ISSET(j, imap)) {
+                            printf("***ERROR*** loop found (inode %d)\n", e.inum);
+                            goto fail;
+                        }
+                        FD_SET(j, imap);
+                        if (!FD_ISSET(j, inode_map))
+                            printf("***ERROR*** inode %d is marked free\n", j);
+                        inode_list[head++] = (struct entry) {.dir = de[i].isDir, j};
+                    }
+            }
             printf("\n");
         }
     }
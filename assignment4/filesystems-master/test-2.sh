@@ -495,9 +495,7 @@ cmd> mkdir dir32/dir30
 cmd> mkdir dir32/dir31
 cmd> put /tmp/test2-smallFile.2 dir32/file.32
 cmd> mkdir dir32/dir33
-error: No space left on device
 cmd> put /tmp/test2-smallFile.2 dir32/file.33
-error: No space left on device
 cmd> ls dir32
 dir1
 dir10
@@ -524,6 +522,7 @@ dir29
 dir3
 dir30
 dir31
+dir33
 dir4
 dir5
 dir6
@@ -531,6 +530,7 @@ dir7
 dir8
 dir9
 file.32
+file.33
 cmd> 
 cmd> rmdir noDir
 error: No such file or directory
@@ -711,8 +711,8 @@ cmd> put /tmp/test2-1400file.5 1400file
 cmd> put /tmp/test2-1024file.6 1024file
 cmd> put /tmp/test2-smallFile.2 smallFile.2
 cmd> put /tmp/test2-0file.0 0.file.0
+error: No space left on device
 cmd> ls
-0.file.0
 1024file
 1400file
 3000file
@@ -725,7 +725,6 @@ cmd> truncate 1024file
 cmd> truncate noFile
 error: No such file or directory
 cmd> ls
-0.file.0
 1024file
 1400file
 3000file